@@ -0,0 +1,166 @@
+#ifndef ABP_DEQUE_HPP
+#define ABP_DEQUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <experimental/optional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace deque {
+namespace abp {
+
+// The bounded deque from "Thread Scheduling for Multiprogrammed
+// Multiprocessors" by Arora, Blumofe and Plaxton, for comparison with
+// the Chase-Lev deque.
+//
+// The top index and a tag share one 64-bit word (`age`), so thieves
+// claim an item with a single CAS. The tag is bumped whenever the
+// owner resets an empty deque to index 0, which keeps a stale thief
+// from succeeding against a recycled slot.
+//
+// Thieves read a slot before their CAS and drop the value if the CAS
+// fails, so the slot may be overwritten under them. That is only
+// sensible for trivially copyable T.
+template <typename T>
+class Deque {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "abp::Deque needs a trivially copyable T");
+
+private:
+  std::atomic<std::uint64_t> age;
+  std::atomic<long> bottom;
+  std::vector<T> segment;
+
+  static std::uint64_t make_age(std::uint64_t tag, std::uint64_t top) {
+    return (tag << 32) | top;
+  }
+
+  static long top_of(std::uint64_t a) {
+    return static_cast<long>(a & 0xffffffff);
+  }
+
+  static std::uint64_t tag_of(std::uint64_t a) {
+    return a >> 32;
+  }
+
+public:
+  explicit Deque(long capacity) : age(0), bottom(0), segment(capacity) {
+  }
+
+  long capacity() const {
+    return static_cast<long>(segment.size());
+  }
+
+  // Returns false if the deque is full.
+  bool push_bottom(const T object) {
+    auto b = bottom.load(std::memory_order_relaxed);
+    if (b == capacity())
+      return false;
+
+    segment[b] = object;
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::experimental::optional<T> pop_bottom() {
+    auto b = bottom.load(std::memory_order_relaxed);
+    std::experimental::optional<T> popped = {};
+    if (b == 0)
+      return popped;
+
+    --b;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto item = segment[b];
+    auto old_age = age.load(std::memory_order_relaxed);
+    if (b > top_of(old_age))
+      return item;
+
+    // At most one item left: reset to an empty deque at index 0 and
+    // race thieves for the last item, if there is one.
+    bottom.store(0, std::memory_order_relaxed);
+    auto new_age = make_age(tag_of(old_age) + 1, 0);
+    if (b == top_of(old_age) &&
+        age.compare_exchange_strong(old_age, new_age,
+                                    std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+      return item;
+
+    age.store(new_age, std::memory_order_seq_cst);
+    return popped;
+  }
+
+  std::experimental::optional<T> steal() {
+    auto old_age = age.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom.load(std::memory_order_acquire);
+    auto t = top_of(old_age);
+
+    std::experimental::optional<T> stolen = {};
+    if (b <= t)
+      return stolen;
+
+    auto item = segment[t];
+    if (age.compare_exchange_strong(old_age, make_age(tag_of(old_age), t + 1),
+                                    std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+      stolen = item;
+
+    return stolen;
+  }
+};
+
+template <typename T>
+class Worker {
+private:
+  std::shared_ptr<Deque<T>> deque;
+
+public:
+  explicit Worker(std::shared_ptr<Deque<T>> d) : deque(d) {
+  }
+
+  // There can only be one worker end.
+  Worker(const Worker<T> &w) = delete;
+
+  Worker(Worker<T> &&w) : deque(std::move(w.deque)) {
+  }
+
+  // Returns false if the deque is full.
+  bool push(const T item) {
+    return deque->push_bottom(item);
+  }
+
+  std::experimental::optional<T> pop() {
+    return deque->pop_bottom();
+  }
+};
+
+// Nothing is reclaimed, so copies don't need to register.
+template <typename T>
+class Stealer {
+private:
+  std::shared_ptr<Deque<T>> deque;
+
+public:
+  explicit Stealer(std::shared_ptr<Deque<T>> d) : deque(d) {
+  }
+
+  std::experimental::optional<T> steal() {
+    return deque->steal();
+  }
+};
+
+// Same as deque::deque(), for a deque with room for `capacity` items.
+template <typename T>
+std::pair<Worker<T>, Stealer<T>> deque(long capacity = 1 << 16) {
+  auto d = std::make_shared<Deque<T>>(capacity);
+  return {Worker<T>(d), Stealer<T>(d)};
+}
+
+} // namespace abp
+} // namespace deque
+
+#endif // ABP_DEQUE_HPP
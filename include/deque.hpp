@@ -2,60 +2,471 @@
 #define DEQUE_HPP
 
 #include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <experimental/optional>
 #include <memory>
+#include <new>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define DEQUE_HAVE_MMAP 1
+#else
+#define DEQUE_HAVE_MMAP 0
+#endif
+
+// Define DEQUE_MIRRORED_BUFFERS to map large buffers of trivial types
+// twice back to back (Linux only), so that any window of the ring is
+// contiguous in memory.
+#if defined(DEQUE_MIRRORED_BUFFERS) && DEQUE_HAVE_MMAP
+#define DEQUE_HAVE_MIRRORED_BUFFERS 1
+#else
+#define DEQUE_HAVE_MIRRORED_BUFFERS 0
+#endif
+
+// Items larger than this many bytes are stored out of line, see
+// SlotStorage.
+#ifndef DEQUE_INDIRECT_THRESHOLD
+#define DEQUE_INDIRECT_THRESHOLD 32
+#endif
+
+#ifndef DEQUE_CACHE_LINE
+#define DEQUE_CACHE_LINE 64
+#endif
+
+// Software prefetch hint. Define DEQUE_NO_PREFETCH to turn it off.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(DEQUE_NO_PREFETCH)
+#define DEQUE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define DEQUE_PREFETCH(addr) ((void) (addr))
+#endif
 
 namespace deque {
 
+// Tells the deque where the payload of a task lives, so that it can be
+// prefetched as soon as the task is popped or stolen. Pointers are
+// followed by default; specialize this for handle types, e.g.
+//
+// template <>
+// struct payload_address<task> {
+//   static const void *get(const task &t) { return t.data; }
+// };
+template <typename T>
+struct payload_address {
+  static const void *get(const T &) {
+    return nullptr;
+  }
+};
+
+template <typename T>
+struct payload_address<T *> {
+  static const void *get(T *const &p) {
+    return p;
+  }
+};
+
+// Specialize this to give every slot in deques of T a cache line of
+// its own:
+//
+// template <>
+// struct pad_slots<task> : std::true_type {};
+//
+// When a deque is short the owner and thieves work on neighbouring
+// slots, and without padding every push invalidates the line thieves
+// are reading. Padding multiplies the buffer size by up to
+// DEQUE_CACHE_LINE / sizeof(T).
+template <typename T>
+struct pad_slots : std::false_type {};
+
+template <typename T>
+void prefetch_payload(const T &item) {
+  auto addr = payload_address<T>::get(item);
+  if (addr)
+    DEQUE_PREFETCH(addr);
+}
+
+// new[] ignores over-alignment before C++17, so we align by hand.
+// `allocation` is set to what has to be passed to aligned_delete().
+template <typename T>
+T *aligned_new(long n, void *&allocation) {
+  auto align = alignof(T);
+  allocation = ::operator new(n * sizeof(T) + align - 1);
+
+  auto addr = reinterpret_cast<std::uintptr_t>(allocation);
+  addr = (addr + align - 1) & ~static_cast<std::uintptr_t>(align - 1);
+  auto array = reinterpret_cast<T *>(addr);
+  for (long i = 0; i < n; ++i)
+    new (&array[i]) T;
+
+  return array;
+}
+
 template <typename T>
+void aligned_delete(T *array, long n, void *allocation) {
+  for (long i = 0; i < n; ++i)
+    array[i].~T();
+  ::operator delete(allocation);
+}
+
+// One slot of a buffer. Padded slots get a cache line to themselves.
+template <typename T, bool Padded>
+struct cell {
+  T value;
+};
+
+template <typename T>
+struct alignas(DEQUE_CACHE_LINE) cell<T, true> {
+  T value;
+};
+
+template <typename T, bool Padded = false>
 class Buffer {
 private:
+  typedef cell<T, Padded> cell_type;
+
   long id_;
   int log_size;
-  T *segment;
-  Buffer<T> *next;
+  cell_type *segment;
+  // What to free if we allocated `segment` ourselves.
+  void *allocation;
+  Buffer *next;
+  // If set, `segment` is mapped twice in a row, so slots
+  // [i % size(), i % size() + size()) are contiguous.
+  bool mirrored;
+  // If nonzero, `segment` points into a range reserved by the deque
+  // with room for 1 << log_reserved slots, and isn't ours to free.
+  int log_reserved;
+
+  std::size_t bytes() const {
+    return bytes_for(log_size);
+  }
+
+#if DEQUE_HAVE_MIRRORED_BUFFERS
+  // Returns null if `bytes` isn't a multiple of the page size, if T
+  // isn't trivial, or if the mapping fails.
+  static cell_type *map_mirrored(std::size_t bytes) {
+    if (!std::is_trivial<cell_type>::value ||
+        bytes % static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) != 0)
+      return nullptr;
+
+    auto fd = memfd_create("deque-buffer", MFD_CLOEXEC);
+    if (fd < 0)
+      return nullptr;
+
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0)
+      base = mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                  -1, 0);
+
+    if (base != MAP_FAILED) {
+      auto lo = mmap(base, bytes, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED, fd, 0);
+      auto hi = mmap(static_cast<char *>(base) + bytes, bytes,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+      if (lo == MAP_FAILED || hi == MAP_FAILED) {
+        munmap(base, 2 * bytes);
+        base = MAP_FAILED;
+      }
+    }
+
+    close(fd);
+    return base == MAP_FAILED ? nullptr : static_cast<cell_type *>(base);
+  }
+
+  static void unmap_mirrored(cell_type *segment, std::size_t bytes) {
+    munmap(segment, 2 * bytes);
+  }
+#else
+  static cell_type *map_mirrored(std::size_t) {
+    return nullptr;
+  }
+
+  static void unmap_mirrored(cell_type *, std::size_t) {
+  }
+#endif
 
 public:
   Buffer(int ls, long id) {
     id_ = id;
     log_size = ls;
-    segment = new T[1 << log_size];
+    allocation = nullptr;
+    segment = map_mirrored(bytes());
+    mirrored = segment != nullptr;
+    if (!mirrored)
+      segment = aligned_new<cell_type>(size(), allocation);
+    log_reserved = 0;
+    next = nullptr;
+  }
+
+  // A buffer using the start of a reserved range, see reserved_deque().
+  Buffer(int ls, long id, void *reserved, int log_res) {
+    id_ = id;
+    log_size = ls;
+    segment = static_cast<cell_type *>(reserved);
+    allocation = nullptr;
+    mirrored = false;
+    log_reserved = log_res;
     next = nullptr;
   }
 
   ~Buffer() {
-    delete[] segment;
+    if (log_reserved)
+      return;
+
+    if (mirrored) {
+      unmap_mirrored(segment, bytes());
+    } else {
+      aligned_delete(segment, size(), allocation);
+    }
+  }
+
+  // The number of bytes taken by 1 << ls slots.
+  static std::size_t bytes_for(int ls) {
+    return sizeof(cell_type) << ls;
+  }
+
+  bool in_reserved_range() const {
+    return log_reserved != 0;
   }
 
   long id() const {
     return id_;
   }
 
-  Buffer<T> *next_buffer() {
+  Buffer *next_buffer() {
     return next;
   }
 
   long size() const {
-    return static_cast<long>(1 << log_size);
+    return 1L << log_size;
   }
 
   T get(long i) const {
-    return segment[i % size()];
+    return segment[i % size()].value;
   }
 
   void put(long i, T item) {
-    segment[i % size()] = item;
+    segment[i % size()].value = item;
+  }
+
+  // Hint that slot `i` is about to be read.
+  void prefetch(long i) const {
+    DEQUE_PREFETCH(&segment[i % size()]);
+  }
+
+  // Call `f` on items [i, i + n), last one first. `n` can't be more
+  // than size().
+  template <typename F>
+  void for_each_reversed(long i, long n, F f) const {
+    if (mirrored) {
+      auto window = segment + i % size();
+      while (n-- > 0)
+        f(window[n].value);
+    } else {
+      for (auto j = i + n - 1; j >= i; --j)
+        f(get(j));
+    }
   }
 
-  Buffer<T> *resize(long b, long t, int delta) {
-    auto buffer = new Buffer<T>(log_size + delta, id_ + 1);
-    for (auto i = t; i < b; ++i)
-      buffer->put(i, get(i));
+  Buffer *resize(long b, long t, int delta) {
+    if (delta > 0 && log_size + delta <= log_reserved) {
+      // Grow in place. Items that don't change slot stay put and the
+      // rest move up into slots that older buffers never use, so
+      // thieves still holding this buffer keep reading valid items.
+      auto buffer =
+        new Buffer(log_size + delta, id_ + 1, segment, log_reserved);
+      for (auto i = t; i < b; ++i) {
+        if (i % size() != i % buffer->size())
+          buffer->put(i, get(i));
+      }
+      next = buffer;
+      return buffer;
+    }
+
+    auto buffer = new Buffer(log_size + delta, id_ + 1);
+    if (mirrored && buffer->mirrored) {
+      // Only trivial types are ever mirrored.
+      std::memcpy(static_cast<void *>(buffer->segment + t % buffer->size()),
+                  segment + t % size(), (b - t) * sizeof(cell_type));
+    } else {
+      for (auto i = t; i < b; ++i)
+        buffer->put(i, get(i));
+    }
     next = buffer;
     return buffer;
   }
 };
 
+// Decides what a buffer slot holds. Small items are stored in the slot
+// itself. Items larger than DEQUE_INDIRECT_THRESHOLD live in a slab
+// owned by the deque and the slot holds a pointer to them, so resizing
+// copies pointers and each slot takes 8 bytes.
+//
+// Thieves read a slot before they claim it, while the owner may be
+// writing it, and drop what they read if the claim fails. That is only
+// safe for trivially copyable slots, so other items go out of line too.
+template <typename T,
+          bool Indirect = (sizeof(T) > DEQUE_INDIRECT_THRESHOLD ||
+                           !std::is_trivially_copyable<T>::value)>
+class SlotStorage {
+public:
+  typedef T slot;
+
+  // Owner only.
+  slot store(const T &item) {
+    return item;
+  }
+
+  // Look at an item without taking it.
+  const T &peek(const slot &s) const {
+    return s;
+  }
+
+  // Take an item we have claimed.
+  T take(const slot &s) {
+    return s;
+  }
+
+  // Drop an item we have claimed.
+  void drop(const slot &) {
+  }
+
+  void reserve(long) {
+  }
+};
+
+template <typename T>
+class SlotStorage<T, true> {
+private:
+  struct node {
+    T value;
+    node *next;
+  };
+
+  static const int chunk_size = 64;
+
+  // Nodes freed by any thread; the owner takes the whole list at once,
+  // so pushing with a CAS doesn't suffer from ABA.
+  std::atomic<node *> freed;
+  // Owner only.
+  node *free_list;
+  // Each chunk and what aligned_new() allocated for it.
+  std::vector<std::pair<node *, void *>> chunks;
+
+  void add_chunk() {
+    void *allocation;
+    auto chunk = aligned_new<node>(chunk_size, allocation);
+    chunks.emplace_back(chunk, allocation);
+    for (auto i = 0; i < chunk_size; ++i)
+      chunk[i].next = i + 1 < chunk_size ? &chunk[i + 1] : free_list;
+    free_list = chunk;
+  }
+
+public:
+  typedef node *slot;
+
+  SlotStorage() : freed(nullptr), free_list(nullptr) {
+  }
+
+  ~SlotStorage() {
+    for (auto &chunk : chunks)
+      aligned_delete(chunk.first, chunk_size, chunk.second);
+  }
+
+  slot store(const T &item) {
+    if (!free_list)
+      free_list = freed.exchange(nullptr, std::memory_order_acquire);
+
+    if (!free_list)
+      add_chunk();
+
+    auto n = free_list;
+    free_list = n->next;
+    n->value = item;
+    return n;
+  }
+
+  const T &peek(const slot &s) const {
+    return s->value;
+  }
+
+  // Move the item out, so that the node doesn't keep what it holds
+  // alive until it is reused.
+  T take(const slot &s) {
+    T item = std::move(s->value);
+    drop(s);
+    return item;
+  }
+
+  void drop(const slot &s) {
+    s->next = freed.load(std::memory_order_relaxed);
+    while (!freed.compare_exchange_weak(s->next, s, std::memory_order_release,
+                                        std::memory_order_relaxed))
+      ;
+  }
+
+  // Make room for `n` items, plus a chunk for items that thieves have
+  // taken but not yet handed back. Nodes are never freed, so after
+  // this storing up to `n` items doesn't allocate.
+  void reserve(long n) {
+    while (static_cast<long>(chunks.size()) * chunk_size < n + chunk_size)
+      add_chunk();
+  }
+};
+
+// A cancellation token shared by all the tasks of one group. Tasks
+// check it before doing any work, and the deque uses it to drop a
+// cancelled group's entries without running them.
+class CancellationToken {
+private:
+  std::atomic<bool> cancelled;
+
+public:
+  CancellationToken() : cancelled(false) {
+  }
+
+  void cancel() {
+    cancelled.store(true, std::memory_order_release);
+  }
+
+  bool is_cancelled() const {
+    return cancelled.load(std::memory_order_acquire);
+  }
+};
+
+// A point-in-time view of a deque for monitoring. The fields are read
+// independently with relaxed loads, so they need not be mutually
+// consistent.
+struct deque_snapshot {
+  long top;
+  long bottom;
+  // Number of slots in the current buffer.
+  long capacity;
+  // Number of unlinked buffers waiting to be reclaimed.
+  long pending_reclaim;
+
+  long size() const {
+    return bottom > top ? bottom - top : 0;
+  }
+};
+
+// Write snapshots of a group of deques as a JSON array.
+inline std::ostream &write_json(std::ostream &os,
+                                const std::vector<deque_snapshot> &snaps) {
+  os << '[';
+  for (std::size_t i = 0; i < snaps.size(); ++i) {
+    const auto &s = snaps[i];
+    os << (i ? "," : "") << "{\"top\":" << s.top << ",\"bottom\":" << s.bottom
+       << ",\"size\":" << s.size() << ",\"capacity\":" << s.capacity
+       << ",\"pending_reclaim\":" << s.pending_reclaim << '}';
+  }
+  return os << ']';
+}
+
 // A buffer_tls is created for each stealer thread. It is intended to
 // be local to that thread; the reclaimer creates one of these
 // whenever a stealer thread is created.
@@ -64,6 +475,9 @@ struct buffer_tls {
   std::atomic<long> id_last_used;
   // If set, we don't check `id_last_used`.
   std::atomic<bool> was_idle;
+  // The deque being stolen from, for records shared between deques
+  // (see StealerSet). Null if the record belongs to a single deque.
+  std::atomic<const void *> in_deque;
   // The next buffer_tls in the list.
   buffer_tls *next;
 };
@@ -93,7 +507,7 @@ public:
 
   // Each stealer thread registers before using the deque.
   buffer_tls *register_thread() {
-    auto tls = new buffer_tls{{0}, {true}, nullptr};
+    auto tls = new buffer_tls{{0}, {true}, {nullptr}, nullptr};
     tls->next = get_id_list();
 
     while (!id_list.compare_exchange_weak(tls->next, tls)) {
@@ -102,22 +516,284 @@ public:
 
     return tls;
   }
+
+  // The minimum of `min_id` and the ids of the buffers that might
+  // still be read by threads stealing from `deque`.
+  long min_id_in_use(long min_id, const void *deque) {
+    auto head = get_id_list();
+
+    while (head) {
+      auto idle = head->was_idle.load(std::memory_order_acquire);
+      if (!idle) {
+        auto in_deque = head->in_deque.load(std::memory_order_acquire);
+        if (!in_deque || in_deque == deque) {
+          auto last_used_id =
+            head->id_last_used.load(std::memory_order_relaxed);
+          min_id = std::min(min_id, last_used_id);
+        }
+      }
+      head = head->next;
+    }
+
+    return min_id;
+  }
+};
+
+// Quiescent-state-based reclamation for a fixed set of threads, e.g.
+// the workers of a Pool. Thread `i` calls quiescent(i) whenever it
+// holds no pointers into any deque, typically between tasks. A buffer
+// retired at some point may be freed once every thread has passed a
+// quiescent state since, so threads of the domain can call
+// Deque::steal() directly and skip the per-steal stores a Stealer
+// makes.
+//
+// Threads that block for a while should go offline(), or they hold up
+// reclamation until they come back online().
+class Qsbr {
+private:
+  struct alignas(DEQUE_CACHE_LINE) participant {
+    std::atomic<unsigned long> count;
+    std::atomic<bool> online;
+  };
+
+  participant *participants;
+  void *allocation;
+  std::size_t n;
+
+public:
+  explicit Qsbr(std::size_t threads)
+    : participants(aligned_new<participant>(static_cast<long>(threads),
+                                            allocation)),
+      n(threads) {
+    for (std::size_t i = 0; i < n; ++i) {
+      participants[i].count.store(0, std::memory_order_relaxed);
+      participants[i].online.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  Qsbr(const Qsbr &) = delete;
+
+  ~Qsbr() {
+    aligned_delete(participants, static_cast<long>(n), allocation);
+  }
+
+  std::size_t size() const {
+    return n;
+  }
+
+  // Only called by thread `i`.
+  void quiescent(std::size_t i) {
+    auto &c = participants[i].count;
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  void offline(std::size_t i) {
+    quiescent(i);
+    participants[i].online.store(false, std::memory_order_release);
+  }
+
+  void online(std::size_t i) {
+    participants[i].online.store(true, std::memory_order_relaxed);
+    // Order the store before any later loads of deque buffers, see
+    // Deque::steal().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Call after retiring something, and pass the result to elapsed().
+  std::vector<unsigned long> snapshot() const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<unsigned long> counts(n);
+    for (std::size_t i = 0; i < n; ++i)
+      counts[i] = participants[i].count.load(std::memory_order_acquire);
+    return counts;
+  }
+
+  // True once every online thread has been quiescent since `counts`
+  // was taken.
+  bool elapsed(const std::vector<unsigned long> &counts) const {
+    for (std::size_t i = 0; i < n; ++i) {
+      if (participants[i].online.load(std::memory_order_acquire) &&
+          participants[i].count.load(std::memory_order_acquire) == counts[i])
+        return false;
+    }
+    return true;
+  }
+};
+
+// Detects that a group of threads has run out of work, without a
+// shared counter of remaining tasks that every thread writes. Thread
+// `i` counts the tasks it creates and the tasks it finishes in
+// counters only it writes, and terminated() adds them all up.
+//
+// Call spawned() before the task can be taken by another thread, and
+// finished() after the task and everything it did, including creating
+// more tasks.
+class TerminationDetector {
+private:
+  struct alignas(DEQUE_CACHE_LINE) counters {
+    std::atomic<unsigned long> spawned;
+    std::atomic<unsigned long> finished;
+  };
+
+  counters *per_thread;
+  void *allocation;
+  std::size_t n;
+
+  static void add(std::atomic<unsigned long> &c, unsigned long k) {
+    c.store(c.load(std::memory_order_relaxed) + k, std::memory_order_release);
+  }
+
+public:
+  explicit TerminationDetector(std::size_t threads)
+    : per_thread(aligned_new<counters>(static_cast<long>(threads),
+                                       allocation)),
+      n(threads) {
+    for (std::size_t i = 0; i < n; ++i) {
+      per_thread[i].spawned.store(0, std::memory_order_relaxed);
+      per_thread[i].finished.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  TerminationDetector(const TerminationDetector &) = delete;
+
+  ~TerminationDetector() {
+    aligned_delete(per_thread, static_cast<long>(n), allocation);
+  }
+
+  std::size_t size() const {
+    return n;
+  }
+
+  // Only called by thread `i`.
+  void spawned(std::size_t i, unsigned long k = 1) {
+    add(per_thread[i].spawned, k);
+  }
+
+  // Only called by thread `i`.
+  void finished(std::size_t i, unsigned long k = 1) {
+    add(per_thread[i].finished, k);
+  }
+
+  // True if every task spawned so far has finished. Once that holds,
+  // only a thread outside the group can spawn more.
+  //
+  // We read all the finished counts before all the spawned counts. A
+  // task counted as finished was spawned before that, and so is every
+  // task it spawned, so the spawned counts we read afterwards include
+  // them. Equal sums then mean nothing was left running.
+  bool terminated() const {
+    unsigned long done = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      done += per_thread[i].finished.load(std::memory_order_acquire);
+
+    unsigned long created = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      created += per_thread[i].spawned.load(std::memory_order_acquire);
+
+    return done == created;
+  }
 };
 
 template <typename T>
 class Deque {
 private:
+  typedef typename SlotStorage<T>::slot slot;
+  typedef Buffer<slot, pad_slots<T>::value> buffer_type;
+
   std::atomic<long> top;
   std::atomic<long> bottom;
-  Buffer<T> *unlinked;
+  buffer_type *unlinked;
   static const int log_initial_size = 4;
+  // Don't shrink the buffer below this, see reserve().
+  long min_capacity;
+  // Only used by DequePtr. Cloning and releasing handles write this,
+  // so it gets a cache line to itself, away from `top` and `bottom`.
+  // Padding rather than alignas, since new ignores over-alignment
+  // before C++17.
+  char refs_pad_before[DEQUE_CACHE_LINE];
+  std::atomic<long> refs;
+  char refs_pad_after[DEQUE_CACHE_LINE];
+  // Monitoring counters, only written when the buffer changes. Reading
+  // these is safe from any thread, unlike dereferencing `buffer`.
+  std::atomic<long> capacity;
+  std::atomic<long> pending_reclaim;
+  // The owner's view of `bottom`. Items between `bottom` and
+  // `local_bottom` haven't been published to thieves yet.
+  long local_bottom;
+  // Publish after this many unpublished pushes; 1 means every push.
+  long publish_interval;
+  // The range reserved by reserved_deque(), if any.
+  void *reserved;
+  std::size_t reserved_bytes;
+  // Set by thieves that found the deque empty, cleared when the owner
+  // publishes new work. Thieves only store to it when it is clear, so
+  // repeated failed steals don't keep dirtying the line, which is its
+  // own so that those stores don't hit `publish_interval` either.
+  char hungry_pad_before[DEQUE_CACHE_LINE];
+  std::atomic<bool> hungry;
+  char hungry_pad_after[DEQUE_CACHE_LINE];
+  SlotStorage<T> slots;
+  // The QSBR domain of the threads stealing from this deque, if any.
+  // Buffers with ids below `qsbr_retired_below` have been retired, and
+  // each entry of `qsbr_pending` is the id of the current buffer and the
+  // domain's snapshot at a retirement.
+  Qsbr *qsbr;
+  long qsbr_retired_below;
+  long qsbr_free_below;
+  std::vector<std::pair<long, std::vector<unsigned long>>> qsbr_pending;
 
 public:
   Reclaimer reclaimer;
-  std::atomic<Buffer<T> *> buffer;
+  // Registration records shared with other deques, see StealerSet.
+  std::shared_ptr<Reclaimer> shared_reclaimer;
+  std::atomic<buffer_type *> buffer;
 
-  Deque() : top(0), bottom(0), unlinked(), reclaimer(),
-	    buffer(new Buffer<T>(log_initial_size, 0)) {
+  Deque() : top(0), bottom(0), unlinked(), min_capacity(0), refs(0),
+	    capacity(1 << log_initial_size), pending_reclaim(0), local_bottom(0),
+	    publish_interval(1), reserved(nullptr), reserved_bytes(0),
+	    hungry(false), slots(), qsbr(nullptr), qsbr_retired_below(0),
+	    qsbr_free_below(0), qsbr_pending(), reclaimer(), shared_reclaimer(),
+	    buffer(new buffer_type(log_initial_size, 0)) {
+  }
+
+  explicit Deque(std::shared_ptr<Reclaimer> shared) : Deque() {
+    shared_reclaimer = shared;
+  }
+
+  // Threads of `domain` may call steal() directly, without a Stealer;
+  // unlinked buffers are freed after a grace period of the domain.
+  // Stealers still work as usual.
+  explicit Deque(Qsbr &domain) : Deque() {
+    qsbr = &domain;
+  }
+
+  // Reserve address space for 1 << log_reserved_size slots up front.
+  // The buffer then grows in place: pages are only committed by the
+  // kernel when they are first written, and growing copies only the
+  // items that change slots. Falls back to a normal deque if the range
+  // can't be reserved.
+  explicit Deque(int log_reserved_size) : Deque() {
+#if DEQUE_HAVE_MMAP
+    static_assert(std::is_trivial<slot>::value,
+                  "reserved deques need a trivial or out-of-line T");
+    if (log_reserved_size <= log_initial_size)
+      return;
+
+    auto bytes = buffer_type::bytes_for(log_reserved_size);
+    auto range = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (range == MAP_FAILED)
+      return;
+
+    reserved = range;
+    reserved_bytes = bytes;
+    delete buffer.load(std::memory_order_relaxed);
+    buffer.store(new buffer_type(log_initial_size, 0, range,
+                                 log_reserved_size),
+                 std::memory_order_relaxed);
+#else
+    (void) log_reserved_size;
+#endif
   }
 
   ~Deque() {
@@ -130,10 +806,78 @@ public:
     }
 
     delete b;
+
+#if DEQUE_HAVE_MMAP
+    if (reserved)
+      munmap(reserved, reserved_bytes);
+#endif
+  }
+
+  void retain() {
+    refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns true when the last reference is dropped.
+  bool release() {
+    return refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  // With an interval of k > 1, pushes are published to thieves only
+  // every k pushes, when a thief finds the deque empty, or when the
+  // owner calls publish(). Until then the owner pops them back without
+  // any fences.
+  void set_publish_interval(long k) {
+    publish_interval = k > 1 ? k : 1;
+    publish();
+  }
+
+  bool thieves_waiting() const {
+    return hungry.load(std::memory_order_relaxed);
+  }
+
+  // The number of items in the deque, including unpublished ones, as
+  // seen by the owner. Only called by the owner.
+  long depth() const {
+    auto d = local_bottom - top.load(std::memory_order_relaxed);
+    return d > 0 ? d : 0;
+  }
+
+  void publish() {
+    // This fence ensures that an object isn't stolen before we update
+    // `bottom`.
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(local_bottom, std::memory_order_relaxed);
+
+    if (hungry.load(std::memory_order_relaxed))
+      hungry.store(false, std::memory_order_relaxed);
+  }
+
+  // Grow the buffer to hold `n` items and keep it at least that big,
+  // and make room for `n` out-of-line items. Afterwards pushes and pops
+  // don't allocate as long as the deque holds at most `n` items.
+  void reserve(long n) {
+    auto b = local_bottom;
+    auto t = top.load(std::memory_order_acquire);
+    auto a = buffer.load(std::memory_order_relaxed);
+
+    auto delta = 0;
+    while ((a->size() << delta) - 1 <= n)
+      ++delta;
+
+    if (delta > 0) {
+      unlinked = unlinked ? unlinked : a;
+      a = a->resize(b, t, delta);
+      buffer.store(a, std::memory_order_release);
+      capacity.store(a->size(), std::memory_order_relaxed);
+      reclaim_buffers(a);
+    }
+
+    min_capacity = a->size();
+    slots.reserve(n);
   }
 
   void push_bottom(const T object) {
-    auto b = bottom.load(std::memory_order_relaxed);
+    auto b = local_bottom;
     auto t = top.load(std::memory_order_acquire);
     auto a = buffer.load(std::memory_order_relaxed);
 
@@ -142,22 +886,51 @@ public:
       unlinked = unlinked ? unlinked : a;
       a = a->resize(b, t, 1);
       buffer.store(a, std::memory_order_release);
+      capacity.store(a->size(), std::memory_order_relaxed);
     }
 
     if (unlinked)
       reclaim_buffers(a);
 
-    a->put(b, object);
-    // This fence ensures that an object isn't stolen before we update
-    // `bottom`.
-    std::atomic_thread_fence(std::memory_order_release);
-    bottom.store(b + 1, std::memory_order_relaxed);
+    // After growing in place, the low slots of the range are also the
+    // slots of the older, smaller buffers, and a thief holding one of
+    // those may still be reading there. Rather than wait for it, move
+    // to an ordinary buffer; later growth happens there too.
+    if (a->in_reserved_range() && b % a->size() < aliased_size(a)) {
+      a = a->resize(b, t, 0);
+      buffer.store(a, std::memory_order_release);
+    }
+
+    a->put(b, slots.store(object));
+    local_bottom = b + 1;
+
+    if (local_bottom - bottom.load(std::memory_order_relaxed) >=
+          publish_interval ||
+        hungry.load(std::memory_order_relaxed))
+      publish();
   }
 
   std::experimental::optional<T> pop_bottom() {
     auto b = bottom.load(std::memory_order_relaxed);
     auto a = buffer.load(std::memory_order_acquire);
 
+    // Don't keep a thief that found the deque empty waiting for the
+    // next push while we pop unpublished items.
+    if (local_bottom > b && hungry.load(std::memory_order_relaxed)) {
+      publish();
+      b = local_bottom;
+    }
+
+    if (local_bottom > b) {
+      // Thieves can't see unpublished items, so there is nothing to
+      // race against.
+      --local_bottom;
+      std::experimental::optional<T> popped =
+        slots.take(a->get(local_bottom));
+      prefetch_payload(*popped);
+      return popped;
+    }
+
     bottom.store(b - 1, std::memory_order_relaxed);
     std::atomic_thread_fence(std::memory_order_seq_cst);
     auto t = top.load(std::memory_order_relaxed);
@@ -172,21 +945,91 @@ public:
       // Race against steals.
       if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
                                       std::memory_order_relaxed))
-        popped = a->get(t);
+        popped = slots.take(a->get(t));
       bottom.store(b, std::memory_order_relaxed);
     } else {
-      popped = a->get(b - 1);
+      popped = slots.take(a->get(b - 1));
 
-      if (size <= a->size() / 3 && size > 1 << log_initial_size) {
+      // Buffers in a reserved range only grow.
+      if (size <= a->size() / 3 && size > 1 << log_initial_size &&
+          a->size() / 2 >= min_capacity && !a->in_reserved_range()) {
         unlinked = unlinked ? unlinked : a;
         a = a->resize(b, t, -1);
         buffer.store(a, std::memory_order_release);
+        capacity.store(a->size(), std::memory_order_relaxed);
       }
 
       if (unlinked)
         reclaim_buffers(a);
+
+      // The next two pops read the slots just below the new bottom.
+      if (b - 2 >= t)
+        a->prefetch(b - 2);
+      if (b - 3 >= t)
+        a->prefetch(b - 3);
     }
 
+    local_bottom = size > 1 ? b - 1 : b;
+
+    if (popped)
+      prefetch_payload(*popped);
+
+    return popped;
+  }
+
+  // Pop up to `k` items into `out`, most recently pushed first, and
+  // return how many were popped. Like pop_bottom() this needs only one
+  // fence. Thieves can only be racing for the lowest item, which we
+  // settle with a CAS on `top` when the batch reaches it.
+  template <typename OutputIt>
+  long pop_bottom_batch(OutputIt out, long k) {
+    if (k <= 0)
+      return 0;
+
+    if (local_bottom != bottom.load(std::memory_order_relaxed))
+      publish();
+
+    auto b = bottom.load(std::memory_order_relaxed);
+    auto a = buffer.load(std::memory_order_acquire);
+
+    auto new_b = b - k;
+    bottom.store(new_b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top.load(std::memory_order_relaxed);
+
+    if (t >= b) {
+      // Deque empty: reverse the decrement to bottom.
+      bottom.store(b, std::memory_order_relaxed);
+      local_bottom = b;
+      return 0;
+    }
+
+    local_bottom = new_b > t ? new_b : t + 1;
+    if (new_b > t) {
+      a->for_each_reversed(new_b, k,
+                           [&](const slot &s) { *out++ = slots.take(s); });
+
+      if (unlinked)
+        reclaim_buffers(a);
+
+      return k;
+    }
+
+    // The batch reaches `top`: everything above it is ours, and we
+    // race against steals for the item at `top`.
+    auto popped = b - t - 1;
+    a->for_each_reversed(t + 1, popped,
+                         [&](const slot &s) { *out++ = slots.take(s); });
+
+    // A failed CAS overwrites `t`, so settle on `local_bottom`, which
+    // is the old t + 1 either way.
+    if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed)) {
+      *out++ = slots.take(a->get(t));
+      ++popped;
+    }
+    bottom.store(local_bottom, std::memory_order_relaxed);
+
     return popped;
   }
 
@@ -198,17 +1041,77 @@ public:
     int size = b - t;
     std::experimental::optional<T> stolen = {};
 
+    if (size <= 0 && !hungry.load(std::memory_order_relaxed))
+      hungry.store(true, std::memory_order_relaxed);
+
     if (size > 0) {
       auto a = buffer.load(std::memory_order_consume);
+      // Read the slot before claiming it: once `top` moves on, other
+      // thieves can move it further and the owner can wrap around onto
+      // this slot.
+      auto s = a->get(t);
       // Race against other steals and a pop.
       if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
-                                      std::memory_order_relaxed))
-        stolen = a->get(t);
+                                      std::memory_order_relaxed)) {
+        stolen = slots.take(s);
+        // Thieves usually come back to the same victim.
+        a->prefetch(t + 1);
+        prefetch_payload(*stolen);
+      }
     }
 
     return stolen;
   }
 
+  // Drop the run of entries at the bottom for which `cancelled`
+  // returns true and return the number of entries dropped.
+  //
+  // If the run stops short of `top` this is a single store to
+  // `bottom`. Otherwise everything left in the deque is cancelled and
+  // we claim it in one go by moving `top` up to `bottom`, which also
+  // settles the race against thieves.
+  template <typename Pred>
+  long discard_bottom(Pred cancelled) {
+    if (local_bottom != bottom.load(std::memory_order_relaxed))
+      publish();
+
+    auto b = bottom.load(std::memory_order_relaxed);
+    auto t = top.load(std::memory_order_acquire);
+    auto a = buffer.load(std::memory_order_relaxed);
+
+    auto new_b = b;
+    while (new_b > t && cancelled(slots.peek(a->get(new_b - 1))))
+      --new_b;
+
+    if (new_b == b)
+      return 0;
+
+    bottom.store(new_b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    t = top.load(std::memory_order_relaxed);
+
+    if (new_b > t) {
+      local_bottom = new_b;
+      a->for_each_reversed(new_b, b - new_b,
+                           [&](const slot &s) { slots.drop(s); });
+      return b - new_b;
+    }
+
+    // Thieves have reached the run. Put `bottom` back and take
+    // whatever they haven't stolen yet.
+    bottom.store(b, std::memory_order_relaxed);
+    local_bottom = b;
+    while (t < b && !top.compare_exchange_weak(t, b, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed))
+      ;
+
+    if (t >= b)
+      return 0;
+
+    a->for_each_reversed(t, b - t, [&](const slot &s) { slots.drop(s); });
+    return b - t;
+  }
+
   // An experimental mechanism to reclaim unlinked buffers. Each
   // stealer thread keeps track of the id of the buffer it last read
   // from. We reclaim all buffers with id strictly less than the
@@ -217,42 +1120,122 @@ public:
   // `new_buffer` points to the current buffer.
   //
   // XXX: Ideally we shouldn't need the pointer to the new buffer.
-  void reclaim_buffers(Buffer<T> *new_buffer) {
-    auto min_id = new_buffer->id();
-    auto head = reclaimer.get_id_list();
-
-    while (head) {
-      auto idle = head->was_idle.load(std::memory_order_acquire);
-      if (!idle) {
-        auto last_used_id = head->id_last_used.load(std::memory_order_relaxed);
-        min_id = std::min(min_id, last_used_id);
-      }
-      head = head->next;
-    }
+  void reclaim_buffers(buffer_type *new_buffer) {
+    auto min_id = reclaimer.min_id_in_use(new_buffer->id(), this);
+    if (shared_reclaimer)
+      min_id = shared_reclaimer->min_id_in_use(min_id, this);
+    if (qsbr)
+      min_id = std::min(min_id, qsbr_min_id(new_buffer->id()));
 
     while (unlinked->id() < min_id) {
       auto reclaimed = unlinked;
       unlinked = unlinked->next_buffer();
       delete reclaimed;
     }
+
+    // Buffer ids are consecutive along the chain.
+    auto pending = new_buffer->id() - unlinked->id();
+    if (pending != pending_reclaim.load(std::memory_order_relaxed))
+      pending_reclaim.store(pending, std::memory_order_relaxed);
+  }
+
+  // The size of the largest unlinked buffer sharing the reserved range
+  // with `current`, or 0 if there is none.
+  long aliased_size(buffer_type *current) {
+    long size = 0;
+    for (auto x = unlinked; x && x != current; x = x->next_buffer()) {
+      if (x->in_reserved_range() && x->size() > size)
+        size = x->size();
+    }
+    return size;
+  }
+
+  // The lowest id of a buffer that threads of the QSBR domain might
+  // still be reading. The first call after a resize notes the grace
+  // period the newly retired buffers have to wait for.
+  long qsbr_min_id(long current_id) {
+    if (qsbr_retired_below < current_id) {
+      qsbr_pending.emplace_back(current_id, qsbr->snapshot());
+      qsbr_retired_below = current_id;
+    }
+
+    while (!qsbr_pending.empty() &&
+           qsbr->elapsed(qsbr_pending.front().second)) {
+      qsbr_free_below = qsbr_pending.front().first;
+      qsbr_pending.erase(qsbr_pending.begin());
+    }
+
+    return qsbr_pending.empty() ? current_id : qsbr_free_below;
+  }
+
+  // Safe to call from any thread, e.g. a monitoring thread.
+  deque_snapshot snapshot() const {
+    return {top.load(std::memory_order_relaxed),
+            bottom.load(std::memory_order_relaxed),
+            capacity.load(std::memory_order_relaxed),
+            pending_reclaim.load(std::memory_order_relaxed)};
   }
 };
 
+// An intrusive pointer to a deque. The count lives in the deque
+// itself, so there is no separate control block to touch.
 template <typename T>
+class DequePtr {
+private:
+  Deque<T> *d;
+
+public:
+  explicit DequePtr(Deque<T> *p) : d(p) {
+    if (d)
+      d->retain();
+  }
+
+  DequePtr(const DequePtr<T> &p) : d(p.d) {
+    if (d)
+      d->retain();
+  }
+
+  DequePtr(DequePtr<T> &&p) : d(p.d) {
+    p.d = nullptr;
+  }
+
+  ~DequePtr() {
+    if (d && d->release())
+      delete d;
+  }
+
+  DequePtr<T> &operator=(DequePtr<T> p) {
+    std::swap(d, p.d);
+    return *this;
+  }
+
+  Deque<T> *operator->() const {
+    return d;
+  }
+
+  Deque<T> &operator*() const {
+    return *d;
+  }
+};
+
+// `Ptr` decides how a handle keeps its deque alive: a shared_ptr (the
+// default), a DequePtr, or a plain Deque<T> * when something else
+// guarantees the deque outlives the handle.
+template <typename T, typename Ptr = std::shared_ptr<Deque<T>>>
 class Worker {
 private:
-  std::shared_ptr<Deque<T>> deque;
+  Ptr deque;
 
 public:
-  explicit Worker(std::shared_ptr<Deque<T>> d) : deque(d) {
+  explicit Worker(Ptr d) : deque(d) {
   }
 
   // Copy constructor.
   // There can only be one worker end.
-  Worker(const Worker<T> &w) = delete;
+  Worker(const Worker<T, Ptr> &w) = delete;
 
   // Move constructor.
-  Worker(Worker<T> &&w) : deque(std::move(w.deque)) {
+  Worker(Worker<T, Ptr> &&w) : deque(std::move(w.deque)) {
   }
 
   ~Worker() {
@@ -265,16 +1248,85 @@ public:
   std::experimental::optional<T> pop() {
     return deque->pop_bottom();
   }
+
+  // Publish only every `k` pushes, or sooner if a thief finds the deque
+  // empty. Call publish() at poll points to bound steal latency.
+  void set_publish_interval(long k) {
+    deque->set_publish_interval(k);
+  }
+
+  // Preallocate for up to `n` items. Together with stealers that are
+  // copied (registered) up front, or views, this makes push, pop and
+  // steal allocation-free in the steady state.
+  void reserve(long n) {
+    deque->reserve(n);
+  }
+
+  void publish() {
+    deque->publish();
+  }
+
+  // True if a thief has found the deque empty since work was last
+  // published. Recursive algorithms can use this to split only on
+  // demand:
+  //
+  // if (worker.thieves_waiting())
+  //   worker.push(right_half);
+  // else
+  //   run(right_half);
+  bool thieves_waiting() const {
+    return deque->thieves_waiting();
+  }
+
+  // Spawn policies can bound the deque with this, e.g.
+  //
+  // if (worker.depth() < limit)
+  //   worker.push(child);
+  // else
+  //   run(child);
+  long depth() const {
+    return deque->depth();
+  }
+
+  // Pop up to `k` items into `out` with a single fence, e.g.
+  //
+  // std::vector<T> batch;
+  // worker.pop_batch(std::back_inserter(batch), 8);
+  template <typename OutputIt>
+  long pop_batch(OutputIt out, long k) {
+    return deque->pop_bottom_batch(out, k);
+  }
+
+  // Drop the cancelled entries at the bottom of the deque, e.g.
+  //
+  // worker.discard([](const task &t) { return t.token->is_cancelled(); });
+  //
+  // Tasks pushed by one group sit together at the bottom, so this
+  // drops a whole cancelled group without popping it one by one.
+  template <typename Pred>
+  long discard(Pred cancelled) {
+    return deque->discard_bottom(cancelled);
+  }
+
+  deque_snapshot snapshot() const {
+    return deque->snapshot();
+  }
 };
 
-template <typename T>
+template <typename T, typename Ptr = std::shared_ptr<Deque<T>>>
 class Stealer {
 private:
-  std::shared_ptr<Deque<T>> deque;
+  template <typename, typename>
+  friend class Stealer;
+
+  Ptr deque;
   buffer_tls *buffer_data;
 
+  Stealer(Ptr d, buffer_tls *data) : deque(d), buffer_data(data) {
+  }
+
 public:
-  explicit Stealer(std::shared_ptr<Deque<T>> d)
+  explicit Stealer(Ptr d)
     : deque(d)
     , buffer_data(deque->reclaimer.register_thread()) {
   }
@@ -282,7 +1334,7 @@ public:
   // Copy constructor.
   //
   // Used whenever a new stealer thread is created.
-  Stealer(const Stealer<T> &s)
+  Stealer(const Stealer<T, Ptr> &s)
     : deque(s.deque)
     , buffer_data(deque->reclaimer.register_thread()) {
   }
@@ -291,7 +1343,7 @@ public:
   //
   // Used when we're passing the stealer end around in the same
   // thread.
-  Stealer(Stealer<T> &&s)
+  Stealer(Stealer<T, Ptr> &&s)
     : deque(std::move(s.deque))
     , buffer_data(s.buffer_data) {
   }
@@ -299,17 +1351,134 @@ public:
   ~Stealer() {
   }
 
+  // A non-owning stealer on the same deque, for handing to tasks that
+  // run on this thread. It shares this stealer's registration and
+  // touches no reference count, so it must not outlive the deque or
+  // be used on another thread. Copying the view registers as usual.
+  Stealer<T, Deque<T> *> view() const {
+    return Stealer<T, Deque<T> *>(&*deque, buffer_data);
+  }
+
   std::experimental::optional<T> steal() {
     // We use memory_order_release to synchronize with the read by the
     // reclaimer. It makes sense, but I'm not absolutely sure about
     // this.
     buffer_data->was_idle.store(false, std::memory_order_release);
     auto stolen = deque->steal();
-    buffer_data->was_idle.store(true, std::memory_order_release);
 
-    // Stealers load the buffer pointer using memory_order_consume.
+    // Stealers load the buffer pointer using memory_order_consume. Do
+    // this before going idle, after which the buffer may be freed.
     auto b = deque->buffer.load(std::memory_order_consume);
     buffer_data->id_last_used.store(b->id(), std::memory_order_relaxed);
+    buffer_data->was_idle.store(true, std::memory_order_release);
+
+    return stolen;
+  }
+
+  // Steal the first entry for which `cancelled` returns false.
+  // Cancelled entries are stolen and dropped without being returned.
+  template <typename Pred>
+  std::experimental::optional<T> steal(Pred cancelled) {
+    auto stolen = steal();
+    while (stolen && cancelled(*stolen))
+      stolen = steal();
+
+    return stolen;
+  }
+
+  deque_snapshot snapshot() const {
+    return deque->snapshot();
+  }
+};
+
+// A stealer for a group of deques, used by a single thread. Instead
+// of a record per deque, the thread registers one record with a
+// reclaimer shared by the whole group, and the record says which deque
+// the thread is currently stealing from. Like Stealer, copy it for
+// each new thread.
+//
+// A thread inside a steal keeps its record's `id_last_used` at zero,
+// so the owner of that deque holds on to all unlinked buffers until
+// the steal is over.
+template <typename T>
+class StealerSet {
+private:
+  std::vector<std::shared_ptr<Deque<T>>> deques;
+  std::shared_ptr<Reclaimer> reclaimer;
+  buffer_tls *buffer_data;
+  // xorshift state for picking victims.
+  std::uint64_t seed;
+
+public:
+  StealerSet(std::vector<std::shared_ptr<Deque<T>>> ds,
+             std::shared_ptr<Reclaimer> r)
+    : deques(std::move(ds))
+    , reclaimer(r)
+    , buffer_data(reclaimer->register_thread())
+    , seed(reinterpret_cast<std::uintptr_t>(buffer_data) | 1) {
+  }
+
+  // Copy constructor.
+  //
+  // Used whenever a new stealer thread is created.
+  StealerSet(const StealerSet<T> &s)
+    : deques(s.deques)
+    , reclaimer(s.reclaimer)
+    , buffer_data(reclaimer->register_thread())
+    , seed(reinterpret_cast<std::uintptr_t>(buffer_data) | 1) {
+  }
+
+  // Move constructor.
+  StealerSet(StealerSet<T> &&s)
+    : deques(std::move(s.deques))
+    , reclaimer(std::move(s.reclaimer))
+    , buffer_data(s.buffer_data)
+    , seed(s.seed) {
+  }
+
+  ~StealerSet() {
+  }
+
+  std::size_t size() const {
+    return deques.size();
+  }
+
+  // Snapshots of every deque in the group, in worker order. See
+  // write_json() for exporting them.
+  std::vector<deque_snapshot> snapshot() const {
+    std::vector<deque_snapshot> snaps;
+    snaps.reserve(deques.size());
+    for (const auto &d : deques)
+      snaps.push_back(d->snapshot());
+
+    return snaps;
+  }
+
+  std::experimental::optional<T> steal_from(std::size_t i) {
+    auto d = deques[i].get();
+
+    buffer_data->in_deque.store(d, std::memory_order_release);
+    buffer_data->was_idle.store(false, std::memory_order_release);
+    auto stolen = d->steal();
+    buffer_data->was_idle.store(true, std::memory_order_release);
+
+    return stolen;
+  }
+
+  // Try each deque once, starting from a random victim.
+  std::experimental::optional<T> steal() {
+    auto n = deques.size();
+    std::experimental::optional<T> stolen = {};
+    if (n == 0)
+      return stolen;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    auto start = static_cast<std::size_t>(seed % n);
+    for (std::size_t i = 0; i < n && !stolen; ++i)
+      stolen = steal_from((start + i) % n);
 
     return stolen;
   }
@@ -337,6 +1506,40 @@ std::pair<Worker<T>, Stealer<T>> deque() {
   return {Worker<T>(d), Stealer<T>(d)};
 }
 
+// Create `n` deques and a StealerSet over all of them. Worker `i`
+// pushes to deque `i`; each stealer thread takes a copy of the set.
+template <typename T>
+std::pair<std::vector<Worker<T>>, StealerSet<T>> deques(std::size_t n) {
+  auto r = std::make_shared<Reclaimer>();
+  std::vector<std::shared_ptr<Deque<T>>> ds;
+  std::vector<Worker<T>> workers;
+  ds.reserve(n);
+  workers.reserve(n);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    ds.push_back(std::make_shared<Deque<T>>(r));
+    workers.emplace_back(ds.back());
+  }
+
+  return {std::move(workers), StealerSet<T>(std::move(ds), r)};
+}
+
+// Same as deque(), but the buffer grows in place within a reserved
+// range of 1 << log_reserved_size slots. T has to be trivial.
+template <typename T>
+std::pair<Worker<T>, Stealer<T>> reserved_deque(int log_reserved_size = 30) {
+  auto d = std::make_shared<Deque<T>>(log_reserved_size);
+  return {Worker<T>(d), Stealer<T>(d)};
+}
+
+// Same as deque(), but the handles share an intrusive count instead of
+// a shared_ptr.
+template <typename T>
+std::pair<Worker<T, DequePtr<T>>, Stealer<T, DequePtr<T>>> intrusive_deque() {
+  auto d = DequePtr<T>(new Deque<T>());
+  return {Worker<T, DequePtr<T>>(d), Stealer<T, DequePtr<T>>(d)};
+}
+
 } // namespace deque
 
 #endif // DEQUE_HPP
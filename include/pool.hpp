@@ -0,0 +1,1013 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <experimental/optional>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "deque.hpp"
+
+namespace deque {
+
+// A dissemination barrier, from "Two Algorithms for Barrier
+// Synchronization" by Hensgen, Finkel and Manber. In round r each
+// participant signals the one 2^r places ahead and waits for the one
+// 2^r places behind, so everybody is through after log2(n) rounds and
+// nobody spins on a line that more than one other thread writes.
+//
+// Flags hold the number of the last episode signalled, so a fast
+// partner that is already in the next episode doesn't need to wait
+// for the flag to be reset.
+class DisseminationBarrier {
+private:
+  static const int max_rounds = 32;
+
+  struct alignas(DEQUE_CACHE_LINE) participant {
+    std::atomic<unsigned long> flags[max_rounds];
+    // Only used by the participant itself.
+    unsigned long episode;
+  };
+
+  participant *participants;
+  void *allocation;
+  std::size_t n;
+
+public:
+  explicit DisseminationBarrier(std::size_t count)
+    : participants(aligned_new<participant>(static_cast<long>(count),
+                                            allocation)),
+      n(count) {
+    for (std::size_t i = 0; i < n; ++i) {
+      for (auto &f : participants[i].flags)
+        f.store(0, std::memory_order_relaxed);
+      participants[i].episode = 0;
+    }
+  }
+
+  DisseminationBarrier(const DisseminationBarrier &) = delete;
+
+  ~DisseminationBarrier() {
+    aligned_delete(participants, static_cast<long>(n), allocation);
+  }
+
+  std::size_t size() const {
+    return n;
+  }
+
+  // Only called by participant `i`. Calls `idle` while waiting for the
+  // others.
+  template <typename Idle>
+  void arrive_and_wait(std::size_t i, Idle idle) {
+    auto &me = participants[i];
+    auto e = ++me.episode;
+
+    int r = 0;
+    for (std::size_t d = 1; d < n; d <<= 1, ++r) {
+      participants[(i + d) % n].flags[r].store(e, std::memory_order_release);
+      while (me.flags[r].load(std::memory_order_acquire) < e)
+        idle();
+    }
+  }
+
+  void arrive_and_wait(std::size_t i) {
+    arrive_and_wait(i, []() { std::this_thread::yield(); });
+  }
+};
+
+// A view of a Reducer, owned by the strand_frame it was created in.
+struct reducer_view {
+  virtual ~reducer_view() {
+  }
+};
+
+struct strand_frame;
+
+// The type-independent part of a Reducer.
+class ReducerBase {
+public:
+  // The frame the reducer was created in. In that frame the reducer's
+  // view is the reducer itself, and views merged into that frame fold
+  // into the reducer.
+  strand_frame *const home;
+
+  explicit ReducerBase(strand_frame *h) : home(h) {
+  }
+
+  virtual ~ReducerBase() {
+  }
+
+  // left = left op right
+  virtual void merge(reducer_view &left, reducer_view &right) const = 0;
+  virtual void merge_into_root(reducer_view &right) = 0;
+};
+
+// The reducer views of a strand of Pool::join() that was stolen. Views
+// are created the first time the strand uses a reducer. Strands that
+// weren't stolen, and the root task, use their parent's views, so
+// there are at most as many frames as steals.
+struct strand_frame {
+  std::vector<std::pair<ReducerBase *, std::unique_ptr<reducer_view>>> views;
+
+  // The frame of the strand running on this thread, or null for the
+  // root strand.
+  static strand_frame *&current() {
+    static thread_local strand_frame *f = nullptr;
+    return f;
+  }
+
+  reducer_view *find(const ReducerBase *r) const {
+    for (const auto &v : views) {
+      if (v.first == r)
+        return v.second.get();
+    }
+    return nullptr;
+  }
+
+  // Fold `right` into `left`, where `right` is the frame of the strand
+  // that serially follows everything `left` has seen so far.
+  static void merge(strand_frame *left, strand_frame &right) {
+    for (auto &v : right.views) {
+      if (left == v.first->home) {
+        v.first->merge_into_root(*v.second);
+        continue;
+      }
+
+      auto mine = left->find(v.first);
+      if (mine)
+        v.first->merge(*mine, *v.second);
+      else
+        left->views.push_back(std::move(v));
+    }
+    right.views.clear();
+  }
+};
+
+// A Cilk-style reducer hyperobject: every strand of a computation made
+// of Pool::join() calls sees its own view, and views are merged in
+// serial order, so `op` need only be associative. The result is the
+// same as running the joins serially, even for non-commutative `op`
+// such as concatenation.
+//
+// deque::Reducer<std::string, std::plus<std::string>> out;
+// pool.submit([&]() {
+//   pool.join([&]() { out.view() += "a"; }, [&]() { out.view() += "b"; });
+// });
+// pool.wait();
+// assert(out.get() == "ab");
+//
+// Only use view() from the strand the reducer was created in and from
+// the strands of its joins. A reducer may be created inside a strand,
+// even a stolen one; get() is ready there once the joins have
+// returned.
+template <typename T, typename Op = std::plus<T>>
+class Reducer : public ReducerBase {
+private:
+  struct view_type : reducer_view {
+    T value;
+
+    explicit view_type(T v) : value(std::move(v)) {
+    }
+  };
+
+  T identity;
+  Op op;
+  T root;
+
+  static T &value_of(reducer_view &v) {
+    return static_cast<view_type &>(v).value;
+  }
+
+public:
+  explicit Reducer(T id = T(), Op o = Op())
+    : ReducerBase(strand_frame::current()), identity(id), op(o),
+      root(std::move(id)) {
+  }
+
+  Reducer(const Reducer &) = delete;
+
+  // The calling strand's view.
+  T &view() {
+    auto f = strand_frame::current();
+    if (f == home)
+      return root;
+
+    auto v = f->find(this);
+    if (!v) {
+      f->views.emplace_back(this, std::unique_ptr<reducer_view>(
+                                    new view_type(identity)));
+      v = f->views.back().second.get();
+    }
+    return value_of(*v);
+  }
+
+  // The result, once the computation has finished.
+  T &get() {
+    return root;
+  }
+
+  void merge(reducer_view &left, reducer_view &right) const override {
+    value_of(left) = op(std::move(value_of(left)), std::move(value_of(right)));
+  }
+
+  void merge_into_root(reducer_view &right) override {
+    root = op(std::move(root), std::move(value_of(right)));
+  }
+};
+
+// Remembers which worker ran each chunk of a loop, see
+// Pool::parallel_for().
+class AffinityPartitioner {
+private:
+  // Only written by the worker running the chunk.
+  std::vector<long> workers;
+  std::size_t pool_size;
+
+public:
+  AffinityPartitioner() : workers(), pool_size(0) {
+  }
+
+  // Start a loop of `chunks` chunks on a pool of `n` workers. A loop of
+  // a different shape starts over with contiguous blocks per worker.
+  void prepare(long chunks, std::size_t n) {
+    if (static_cast<long>(workers.size()) == chunks && pool_size == n)
+      return;
+
+    workers.resize(chunks);
+    pool_size = n;
+    for (long c = 0; c < chunks; ++c)
+      workers[c] = c * static_cast<long>(n) / chunks;
+  }
+
+  std::size_t worker_of(long chunk) const {
+    return static_cast<std::size_t>(workers[chunk]);
+  }
+
+  void ran(long chunk, long worker) {
+    workers[chunk] = worker;
+  }
+};
+
+// A fixed set of worker threads, each owning a Chase-Lev deque of
+// tasks. A worker pops from its own deque, then takes work submitted
+// from outside the pool, then steals from the other workers.
+//
+// The workers are the QSBR domain of all the deques (see Qsbr): they
+// announce quiescence between tasks, so steals go straight to
+// Deque::steal() without the stores a Stealer makes.
+//
+// Work can be split into weighted job groups, e.g. one per tenant,
+// each with its own deque per worker. Workers pick a group by deficit
+// round-robin, so a group with weight 2 gets about twice the tasks run
+// of a group with weight 1 while both have work, however much either
+// has queued up. Tasks go to the group of the task submitting them.
+//
+// deque::Pool pool(4);
+// pool.submit([&pool]() {
+//   pool.submit([]() { /* runs on the same worker unless stolen */ });
+// });
+// pool.wait();
+//
+// For bulk-synchronous phases, run_on_each() runs a function once on
+// every worker, and barrier() separates the phases:
+//
+// pool.run_on_each([&pool](std::size_t i) {
+//   for (auto phase = 0; phase < phases; ++phase) {
+//     /* work on part i, maybe submitting tasks */
+//     pool.barrier();
+//   }
+// });
+class Pool {
+public:
+  typedef std::function<void()> task;
+
+private:
+  struct current_worker {
+    const Pool *pool;
+    std::size_t index;
+    // xorshift state for picking victims.
+    std::uint64_t seed;
+    // The group of the task being run.
+    std::size_t group;
+    // Deficit round-robin state: the group whose turn it is, and how
+    // many more tasks each group may run in its turn.
+    std::size_t turn;
+    std::vector<long> deficit;
+  };
+
+  // A job group, with a deque per worker and a queue for work
+  // submitted from outside the pool.
+  struct group {
+    long weight;
+    std::vector<std::unique_ptr<Deque<task>>> deques;
+    // Under `injected_lock`.
+    std::deque<task> injected;
+    std::atomic<long> injected_size;
+  };
+
+  // The second half of a join(), on the stack of the worker that
+  // called it.
+  struct join_state {
+    task body;
+    std::atomic<bool> done;
+    // Reducer views, if `body` was stolen.
+    strand_frame frame;
+  };
+
+  // What join() pushes. Only runs if `body` was stolen; the worker
+  // that called join() runs `body` itself otherwise.
+  struct join_task {
+    join_state *state;
+
+    void operator()() const {
+      strand_frame::current() = &state->frame;
+      state->body();
+      state->done.store(true, std::memory_order_release);
+    }
+  };
+
+  Qsbr qsbr;
+  std::vector<std::unique_ptr<group>> groups;
+  // Protects the queues of work submitted from outside the pool.
+  std::mutex injected_lock;
+  // Counters for worker i at index i, and for submissions from outside
+  // the pool, made under `injected_lock`, at index size().
+  TerminationDetector termination;
+  // Tasks posted to worker i by submit_with_affinity(). Any thread
+  // posts, only worker i takes.
+  struct mailbox {
+    std::mutex lock;
+    std::deque<task> tasks;
+    std::atomic<long> size;
+  };
+  std::vector<std::unique_ptr<mailbox>> mailboxes;
+  // A task in a mailbox and somewhere else, run by whoever claims it.
+  struct claimable {
+    std::atomic<bool> claimed{false};
+    task body;
+  };
+  // Functions from run_on_each() waiting for worker i. Only they may
+  // call barrier().
+  std::unique_ptr<std::atomic<task *>[]> pinned;
+  DisseminationBarrier phases;
+  // See set_spawn_limit().
+  std::atomic<long> spawn_limit;
+  std::atomic<bool> stopping;
+  // Idle workers sleep on `idle_wakeup` until `idle_epoch` moves, see
+  // park() and notify(). `parked` counts the workers on their way to
+  // sleep or asleep, so that notify() costs nothing while all are busy.
+  std::mutex idle_lock;
+  std::condition_variable idle_wakeup;
+  std::atomic<unsigned long> idle_epoch;
+  std::atomic<long> parked;
+  std::vector<std::thread> threads;
+
+  // Failed attempts to find a task before a worker parks.
+  static const int spins_before_parking = 64;
+
+  static current_worker &current() {
+    static thread_local current_worker w = {nullptr, 0, 0, 0, 0, {}};
+    return w;
+  }
+
+  std::experimental::optional<task> take_mail(std::size_t i) {
+    std::experimental::optional<task> taken = {};
+    auto &m = *mailboxes[i];
+    if (m.size.load(std::memory_order_relaxed) == 0)
+      return taken;
+
+    std::lock_guard<std::mutex> guard(m.lock);
+    if (!m.tasks.empty()) {
+      taken = std::move(m.tasks.front());
+      m.tasks.pop_front();
+      m.size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return taken;
+  }
+
+  std::experimental::optional<task> take_injected(group &g) {
+    std::experimental::optional<task> taken = {};
+    if (g.injected_size.load(std::memory_order_relaxed) == 0)
+      return taken;
+
+    std::lock_guard<std::mutex> guard(injected_lock);
+    if (!g.injected.empty()) {
+      taken = std::move(g.injected.front());
+      g.injected.pop_front();
+      g.injected_size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return taken;
+  }
+
+  // Try each other worker's deque of the group once, starting from a
+  // random victim.
+  std::experimental::optional<task> steal(std::size_t i, group &g) {
+    auto &deques = g.deques;
+    auto n = deques.size();
+    auto &seed = current().seed;
+    std::experimental::optional<task> stolen = {};
+
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    auto start = static_cast<std::size_t>(seed % n);
+    for (std::size_t k = 0; k < n && !stolen; ++k) {
+      auto victim = (start + k) % n;
+      if (victim != i)
+        stolen = deques[victim]->steal();
+    }
+    return stolen;
+  }
+
+  std::experimental::optional<task> find_in_group(std::size_t i,
+                                                  group &g) {
+    auto t = g.deques[i]->pop_bottom();
+    if (!t)
+      t = take_injected(g);
+    if (!t)
+      t = steal(i, g);
+    return t;
+  }
+
+  // Pinned and mailed tasks come first. Then groups take turns: in its
+  // turn a group may run up to `weight` tasks, and a group without
+  // work loses the rest of its turn. Each worker keeps its own turns,
+  // so there is no shared scheduler state.
+  std::experimental::optional<task> find_task(std::size_t i,
+                                              std::size_t &g) {
+    std::experimental::optional<task> t = {};
+    g = 0;
+    if (pinned[i].load(std::memory_order_relaxed)) {
+      std::unique_ptr<task> p(
+        pinned[i].exchange(nullptr, std::memory_order_acquire));
+      t = std::move(*p);
+      return t;
+    }
+
+    t = take_mail(i);
+    if (t)
+      return t;
+
+    auto &w = current();
+    auto n = groups.size();
+    for (std::size_t k = 0; k < n && !t; ++k) {
+      g = (w.turn + k) % n;
+      t = find_in_group(i, *groups[g]);
+    }
+
+    if (t) {
+      if (g != w.turn || w.deficit[g] <= 0) {
+        w.turn = g;
+        w.deficit[g] = groups[g]->weight;
+      }
+      if (--w.deficit[g] <= 0)
+        w.turn = (g + 1) % n;
+    }
+    return t;
+  }
+
+  // Hand `t` to worker i, once it has taken what was there before.
+  void pin(std::size_t i, task *t) {
+    task *expected = nullptr;
+    while (!pinned[i].compare_exchange_weak(expected, t,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+      expected = nullptr;
+      std::this_thread::yield();
+    }
+    notify();
+  }
+
+  // Wake the parked workers. Call after making new work visible.
+  void notify() {
+    // Pairs with the increment of `parked` in park(): either we see
+    // the worker there, or it sees our work when it looks again.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_relaxed) == 0)
+      return;
+
+    std::lock_guard<std::mutex> guard(idle_lock);
+    idle_epoch.fetch_add(1, std::memory_order_relaxed);
+    idle_wakeup.notify_all();
+  }
+
+  // Look for work one last time, and sleep until notify() if there is
+  // none. A sleeping worker is offline, so it doesn't hold up QSBR.
+  void park(std::size_t i) {
+    auto epoch = idle_epoch.load(std::memory_order_relaxed);
+    parked.fetch_add(1, std::memory_order_seq_cst);
+
+    std::size_t g;
+    auto t = find_task(i, g);
+    if (!t) {
+      qsbr.offline(i);
+      std::unique_lock<std::mutex> guard(idle_lock);
+      while (idle_epoch.load(std::memory_order_relaxed) == epoch &&
+             !stopping.load(std::memory_order_acquire))
+        idle_wakeup.wait(guard);
+      guard.unlock();
+      qsbr.online(i);
+    }
+
+    parked.fetch_sub(1, std::memory_order_relaxed);
+    if (t)
+      execute(*t, i, g);
+  }
+
+  void run(std::size_t i) {
+    current() = {this, i, 0x9e3779b97f4a7c15ull * (i + 1), 0, 0,
+                 std::vector<long>(groups.size())};
+
+    auto idle = 0;
+    while (!stopping.load(std::memory_order_acquire)) {
+      if (run_one(i)) {
+        idle = 0;
+      } else if (++idle < spins_before_parking) {
+        std::this_thread::yield();
+      } else {
+        park(i);
+        idle = 0;
+      }
+      qsbr.quiescent(i);
+    }
+
+    qsbr.offline(i);
+  }
+
+  // Run one task on worker `i`, if there is one.
+  bool run_one(std::size_t i) {
+    std::size_t g;
+    auto t = find_task(i, g);
+    if (!t)
+      return false;
+
+    execute(*t, i, g);
+    return true;
+  }
+
+  // Run a task of group `g` that isn't part of the strand we are in,
+  // e.g. because we are waiting in join().
+  void execute(task &t, std::size_t i, std::size_t g) {
+    auto &frame = strand_frame::current();
+    auto &w = current();
+    auto saved_frame = frame;
+    auto saved_group = w.group;
+    frame = nullptr;
+    w.group = g;
+    t();
+    t = {};
+    frame = saved_frame;
+    w.group = saved_group;
+    termination.finished(i);
+  }
+
+  // Wait for the second half of a join() on worker `i`, which pushed
+  // it to its deque of group `g`. Until it is done we keep running
+  // other tasks, popping our own first: if `state` is still there it
+  // wasn't stolen and we run it in the current strand.
+  void wait_for(join_state &state, std::size_t i, std::size_t g) {
+    auto &own = *groups[g]->deques[i];
+    while (!state.done.load(std::memory_order_acquire)) {
+      auto t = own.pop_bottom();
+      if (t) {
+        auto j = t->target<join_task>();
+        if (j && j->state == &state) {
+          state.body();
+          termination.finished(i);
+          return;
+        }
+        execute(*t, i, g);
+        continue;
+      }
+
+      if (!run_one(i))
+        std::this_thread::yield();
+      qsbr.quiescent(i);
+    }
+
+    strand_frame::merge(strand_frame::current(), state.frame);
+  }
+
+  bool too_deep(const Deque<task> &own) const {
+    auto limit = spawn_limit.load(std::memory_order_relaxed);
+    return limit > 0 && own.depth() >= limit;
+  }
+
+  template <typename F>
+  void split(long begin, long end, long grain, F &f) {
+    if (end - begin <= std::max(grain, 1L)) {
+      if (begin < end)
+        f(begin, end);
+      return;
+    }
+
+    auto mid = begin + (end - begin) / 2;
+    join([this, begin, mid, grain, &f]() { split(begin, mid, grain, f); },
+         [this, mid, end, grain, &f]() { split(mid, end, grain, f); });
+  }
+
+public:
+  explicit Pool(std::size_t nthreads = std::thread::hardware_concurrency())
+    : Pool(nthreads, {1}) {
+  }
+
+  // A pool with a job group for each weight, numbered from 0. Tasks
+  // submitted from outside the pool go to group 0 unless submitted
+  // with submit_to_group().
+  Pool(std::size_t nthreads, std::vector<long> weights)
+    : qsbr(nthreads ? nthreads : 1), groups(), injected_lock(),
+      termination(qsbr.size() + 1), mailboxes(),
+      pinned(new std::atomic<task *>[qsbr.size()]), phases(qsbr.size()),
+      spawn_limit(0), stopping(false), idle_lock(), idle_wakeup(),
+      idle_epoch(0), parked(0), threads() {
+    if (weights.empty())
+      weights.push_back(1);
+    for (auto weight : weights) {
+      groups.emplace_back(new group());
+      auto &g = *groups.back();
+      g.weight = weight > 0 ? weight : 1;
+      g.injected_size.store(0, std::memory_order_relaxed);
+      for (std::size_t i = 0; i < qsbr.size(); ++i)
+        g.deques.emplace_back(new Deque<task>(qsbr));
+    }
+
+    for (std::size_t i = 0; i < qsbr.size(); ++i) {
+      mailboxes.emplace_back(new mailbox());
+      mailboxes[i]->size.store(0, std::memory_order_relaxed);
+      pinned[i].store(nullptr, std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < qsbr.size(); ++i)
+      threads.emplace_back([this, i]() { run(i); });
+  }
+
+  Pool(const Pool &) = delete;
+
+  // Waits for the submitted tasks to finish.
+  ~Pool() {
+    wait();
+    stopping.store(true, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> guard(idle_lock);
+      idle_wakeup.notify_all();
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+
+  std::size_t size() const {
+    return qsbr.size();
+  }
+
+  std::size_t group_count() const {
+    return groups.size();
+  }
+
+  // Once a worker's deque holds `depth` tasks, submit() from that
+  // worker runs the new task right away and join() runs both halves
+  // serially, instead of pushing. This keeps a task that spawns faster
+  // than thieves take its work from growing the deque, and with it
+  // resize copies and unreclaimed buffers, without bound. Thieves
+  // always find work in a deque that deep. 0, the default, means no
+  // limit.
+  void set_spawn_limit(long depth) {
+    spawn_limit.store(depth > 0 ? depth : 0, std::memory_order_relaxed);
+  }
+
+  // The index of the calling thread among this pool's workers, or -1
+  // if it isn't one of them.
+  long worker_index() const {
+    auto &w = current();
+    return w.pool == this ? static_cast<long>(w.index) : -1;
+  }
+
+  // Called from a worker, this pushes onto its own deque, in the group
+  // of the task that is running.
+  void submit(task t) {
+    auto i = worker_index();
+    submit_to_group(i >= 0 ? current().group : 0, std::move(t));
+  }
+
+  void submit_to_group(std::size_t g, task t) {
+    auto i = worker_index();
+    if (i >= 0) {
+      termination.spawned(i);
+      auto &own = *groups[g]->deques[i];
+      if (too_deep(own)) {
+        execute(t, i, g);
+      } else {
+        own.push_bottom(std::move(t));
+        notify();
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(injected_lock);
+      termination.spawned(size());
+      groups[g]->injected.push_back(std::move(t));
+      groups[g]->injected_size.fetch_add(1, std::memory_order_relaxed);
+    }
+    notify();
+  }
+
+  // Submit a task whose data lives with worker `w`, e.g. because `w`
+  // produced it. As in "The Data Locality of Work Stealing" by Acar,
+  // Blelloch and Blumofe, the task goes both where submit() would put
+  // it and into w's mailbox, which w checks before stealing. Whoever
+  // gets to it first claims it; the other copy does nothing.
+  void submit_with_affinity(std::size_t w, task t) {
+    auto i = worker_index();
+    if (i == static_cast<long>(w)) {
+      submit(std::move(t));
+      return;
+    }
+
+    auto g = i >= 0 ? current().group : 0;
+    auto shared = std::make_shared<claimable>();
+    shared->body = std::move(t);
+    task copy = [shared, g]() {
+      if (!shared->claimed.exchange(true, std::memory_order_acq_rel)) {
+        current().group = g;
+        shared->body();
+      }
+    };
+
+    // Both copies are counted, and both finish.
+    if (i >= 0) {
+      termination.spawned(i, 2);
+      groups[g]->deques[i]->push_bottom(copy);
+    } else {
+      std::lock_guard<std::mutex> guard(injected_lock);
+      termination.spawned(size(), 2);
+      groups[g]->injected.push_back(copy);
+      groups[g]->injected_size.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+      auto &m = *mailboxes[w];
+      std::lock_guard<std::mutex> guard(m.lock);
+      m.tasks.push_back(std::move(copy));
+      m.size.fetch_add(1, std::memory_order_relaxed);
+    }
+    notify();
+  }
+
+  // Block until every submitted task, and everything they submitted,
+  // has finished. Only call this from outside the pool.
+  void wait() {
+    while (!termination.terminated())
+      std::this_thread::yield();
+  }
+
+  // Run `a` and `b`, maybe in parallel, and return once both are done.
+  // `b` is offered to thieves while `a` runs here, and if nobody took
+  // it we run it right after, so this works like a Cilk spawn of `a`
+  // followed by a sync. Called from outside the pool, this just runs
+  // `a` and then `b`.
+  template <typename A, typename B>
+  void join(A a, B b) {
+    auto w = worker_index();
+    if (w < 0) {
+      a();
+      b();
+      return;
+    }
+
+    auto i = static_cast<std::size_t>(w);
+    auto g = current().group;
+    if (too_deep(*groups[g]->deques[i])) {
+      a();
+      b();
+      return;
+    }
+
+    join_state state{task(std::move(b)), {false}, {}};
+    termination.spawned(i);
+    groups[g]->deques[i]->push_bottom(task(join_task{&state}));
+    notify();
+    a();
+    wait_for(state, i, g);
+  }
+
+  // Run `f(i)` on worker i for every i, and wait() for everything to
+  // finish. These calls aren't stolen, so each worker has exactly one
+  // and they can synchronize with barrier(). Only call this from
+  // outside the pool.
+  void run_on_each(std::function<void(std::size_t)> f) {
+    {
+      std::lock_guard<std::mutex> guard(injected_lock);
+      termination.spawned(size(), size());
+    }
+
+    for (std::size_t i = 0; i < size(); ++i)
+      pin(i, new task([f, i]() { f(i); }));
+
+    wait();
+  }
+
+  // Start a parallel region with `tasks` already spread over the
+  // workers: worker i pushes the i-th contiguous block onto its own
+  // deque of group 0, so nobody has to steal the initial work one task
+  // at a time. Stealing still evens out whatever imbalance is left.
+  // Call wait() for the tasks to finish. Only call this from outside
+  // the pool.
+  void seed(std::vector<task> tasks) {
+    auto n = tasks.size();
+    auto p = size();
+    std::vector<std::vector<task>> parts(p);
+    for (std::size_t i = 0; i < p; ++i)
+      parts[i].assign(
+        std::make_move_iterator(tasks.begin() + i * n / p),
+        std::make_move_iterator(tasks.begin() + (i + 1) * n / p));
+
+    seed(std::move(parts));
+  }
+
+  // Same, with the tasks for worker i in parts[i].
+  void seed(std::vector<std::vector<task>> parts) {
+    std::size_t n = 0;
+    for (const auto &part : parts)
+      n += part.size();
+    {
+      std::lock_guard<std::mutex> guard(injected_lock);
+      termination.spawned(size(), n + size());
+    }
+
+    for (std::size_t i = 0; i < size(); ++i) {
+      std::vector<task> part;
+      if (i < parts.size())
+        part.swap(parts[i]);
+
+      // The pushes were counted above.
+      pin(i, new task([this, i, part = std::move(part)]() {
+        for (auto &t : part)
+          groups[0]->deques[i]->push_bottom(t);
+        notify();
+      }));
+    }
+  }
+
+  // Call `f(lo, hi)` on consecutive subranges of [begin, end) of at
+  // most `grain` items, splitting the range in halves with join().
+  // Called from outside the pool, this runs the loop on the pool and
+  // waits for it.
+  template <typename F>
+  void parallel_for(long begin, long end, long grain, F f) {
+    if (worker_index() >= 0) {
+      split(begin, end, grain, f);
+      return;
+    }
+
+    submit([this, begin, end, grain, &f]() { split(begin, end, grain, f); });
+    wait();
+  }
+
+  // Same, for loops run over the same range again and again. The
+  // range is cut into chunks of `grain` items, and `ap` remembers which
+  // worker ran each chunk. The next loop seeds every chunk straight
+  // into that worker's deque, where its data is likely still in cache;
+  // stealing still evens out the load, and moved chunks are noted for
+  // the next time. Only call this from outside the pool; inside it
+  // falls back to the plain loop.
+  template <typename F>
+  void parallel_for(long begin, long end, long grain, F f,
+                    AffinityPartitioner &ap) {
+    if (worker_index() >= 0) {
+      split(begin, end, grain, f);
+      return;
+    }
+
+    grain = grain > 0 ? grain : 1;
+    auto chunks = end > begin ? (end - begin + grain - 1) / grain : 0;
+    ap.prepare(chunks, size());
+
+    std::vector<std::vector<task>> parts(size());
+    for (long c = 0; c < chunks; ++c) {
+      auto lo = begin + c * grain;
+      auto hi = std::min(lo + grain, end);
+      parts[ap.worker_of(c)].emplace_back([this, lo, hi, c, &f, &ap]() {
+        ap.ran(c, worker_index());
+        f(lo, hi);
+      });
+    }
+
+    seed(std::move(parts));
+    wait();
+  }
+
+  // Wait for the functions started by run_on_each() on all workers to
+  // get here. Meanwhile the worker keeps running other tasks, so work
+  // submitted during a phase gets done by whoever is waiting. Tasks
+  // may still be running when the barrier trips.
+  void barrier() {
+    auto i = static_cast<std::size_t>(worker_index());
+    phases.arrive_and_wait(i, [this, i]() {
+      if (!run_one(i))
+        std::this_thread::yield();
+      qsbr.quiescent(i);
+    });
+  }
+
+  // Snapshots of the workers' deques, those of group 0 first, see
+  // write_json().
+  std::vector<deque_snapshot> snapshot() const {
+    std::vector<deque_snapshot> snaps;
+    snaps.reserve(groups.size() * size());
+    for (const auto &g : groups) {
+      for (const auto &d : g->deques)
+        snaps.push_back(d->snapshot());
+    }
+
+    return snaps;
+  }
+};
+
+// Per-worker values of T for reductions on a Pool, so that tasks
+// don't all update one shared variable. Each worker gets a slot on its
+// own cache lines, initialised by `init` the first time the worker
+// asks for it, and combine() folds the slots together afterwards.
+//
+// deque::Combinable<long> count(pool);
+// pool.submit([&count]() { ++count.local(); });
+// pool.wait();
+// auto total = count.combine(std::plus<long>());
+//
+// Threads outside the pool share one extra slot, so only one of them
+// may use local() at a time.
+template <typename T>
+class Combinable {
+private:
+  struct alignas(DEQUE_CACHE_LINE) slot {
+    std::experimental::optional<T> value;
+  };
+
+  const Pool &pool;
+  std::function<T()> init;
+  slot *slots;
+  void *allocation;
+  std::size_t n;
+
+public:
+  explicit Combinable(const Pool &p,
+                      std::function<T()> initial = []() { return T(); })
+    : pool(p), init(std::move(initial)),
+      slots(aligned_new<slot>(static_cast<long>(p.size() + 1), allocation)),
+      n(p.size() + 1) {
+  }
+
+  Combinable(const Combinable &) = delete;
+
+  ~Combinable() {
+    aligned_delete(slots, static_cast<long>(n), allocation);
+  }
+
+  // The calling worker's value.
+  T &local() {
+    auto i = pool.worker_index();
+    auto &s = slots[i >= 0 ? static_cast<std::size_t>(i) : n - 1];
+    if (!s.value)
+      s.value = init();
+    return *s.value;
+  }
+
+  // Call `f` on every value that has been initialised. Only call this
+  // once the tasks using local() have finished.
+  template <typename F>
+  void combine_each(F f) const {
+    for (std::size_t i = 0; i < n; ++i) {
+      if (slots[i].value)
+        f(*slots[i].value);
+    }
+  }
+
+  // Fold the initialised values with `f`, or return a fresh value if
+  // there are none. Only call this once the tasks using local() have
+  // finished.
+  template <typename F>
+  T combine(F f) const {
+    std::experimental::optional<T> result = {};
+    combine_each([&result, &f](const T &v) {
+      result = result ? f(*result, v) : v;
+    });
+    return result ? *result : init();
+  }
+
+  // Drop all the values, e.g. between two reductions.
+  void clear() {
+    for (std::size_t i = 0; i < n; ++i)
+      slots[i].value = {};
+  }
+};
+
+} // namespace deque
+
+#endif // POOL_HPP
@@ -0,0 +1,169 @@
+#ifndef SPLIT_DEQUE_HPP
+#define SPLIT_DEQUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <experimental/optional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace deque {
+namespace split {
+
+// A split deque in the style of "Scalable Work Stealing" by Dinan et
+// al. The deque is cut at `split`:
+//
+//   [top, split)     public, thieves steal from `top` under the lock
+//   [split, tail)    private, the owner pushes and pops with plain
+//                    loads and stores
+//
+// When the public part runs dry the owner releases the `release_count`
+// oldest private items by moving `split` up. When the private part
+// runs dry the owner takes the lock and reacquires half of the public
+// part. Thieves only touch the buffer under the lock, so the owner
+// grows it under the lock and frees the old one right away.
+template <typename T>
+class SplitDeque {
+private:
+  std::atomic<long> top;
+  std::atomic<long> split;
+  // Only used by the owner.
+  long tail;
+  long release_count;
+  std::mutex lock;
+  std::vector<T> segment;
+  static const int log_initial_size = 4;
+
+  long size() const {
+    return static_cast<long>(segment.size());
+  }
+
+  // Called with the lock held.
+  void grow(long t) {
+    std::vector<T> bigger(segment.size() * 2);
+    for (auto i = t; i < tail; ++i)
+      bigger[i % bigger.size()] = segment[i % size()];
+    segment.swap(bigger);
+  }
+
+public:
+  explicit SplitDeque(long k)
+    : top(0), split(0), tail(0), release_count(k > 1 ? k : 1), lock(),
+      segment(1 << log_initial_size) {
+  }
+
+  // Move up to `release_count` private items to the public part.
+  void release() {
+    auto s = split.load(std::memory_order_relaxed);
+    auto n = std::min(release_count, tail - s);
+    if (n > 0)
+      split.store(s + n, std::memory_order_release);
+  }
+
+  void push_bottom(const T object) {
+    // Acquire pairs with the release in steal(), so a slot is only
+    // reused once the thief that moved `top` past it has read it.
+    if (tail - top.load(std::memory_order_acquire) >= size()) {
+      std::lock_guard<std::mutex> guard(lock);
+      grow(top.load(std::memory_order_relaxed));
+    }
+
+    segment[tail % size()] = object;
+    ++tail;
+
+    if (top.load(std::memory_order_acquire) ==
+        split.load(std::memory_order_relaxed))
+      release();
+  }
+
+  std::experimental::optional<T> pop_bottom() {
+    std::experimental::optional<T> popped = {};
+
+    if (tail == split.load(std::memory_order_relaxed)) {
+      // Private part is empty: take back half of the public part.
+      std::lock_guard<std::mutex> guard(lock);
+      auto t = top.load(std::memory_order_relaxed);
+      auto s = split.load(std::memory_order_relaxed);
+      if (t == s)
+        return popped;
+      split.store(s - (s - t + 1) / 2, std::memory_order_relaxed);
+    }
+
+    --tail;
+    popped = segment[tail % size()];
+    return popped;
+  }
+
+  std::experimental::optional<T> steal() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::experimental::optional<T> stolen = {};
+
+    auto t = top.load(std::memory_order_relaxed);
+    if (t < split.load(std::memory_order_acquire)) {
+      stolen = segment[t % size()];
+      top.store(t + 1, std::memory_order_release);
+    }
+
+    return stolen;
+  }
+};
+
+template <typename T>
+class Worker {
+private:
+  std::shared_ptr<SplitDeque<T>> deque;
+
+public:
+  explicit Worker(std::shared_ptr<SplitDeque<T>> d) : deque(d) {
+  }
+
+  // There can only be one worker end.
+  Worker(const Worker<T> &w) = delete;
+
+  Worker(Worker<T> &&w) : deque(std::move(w.deque)) {
+  }
+
+  void push(const T item) {
+    deque->push_bottom(item);
+  }
+
+  std::experimental::optional<T> pop() {
+    return deque->pop_bottom();
+  }
+
+  // Hand private work to thieves without waiting for the public part
+  // to run dry.
+  void release() {
+    deque->release();
+  }
+};
+
+// Thieves synchronize through the lock, so copies don't need to
+// register.
+template <typename T>
+class Stealer {
+private:
+  std::shared_ptr<SplitDeque<T>> deque;
+
+public:
+  explicit Stealer(std::shared_ptr<SplitDeque<T>> d) : deque(d) {
+  }
+
+  std::experimental::optional<T> steal() {
+    return deque->steal();
+  }
+};
+
+// Same as deque::deque(); the owner releases `release_count` items at
+// a time.
+template <typename T>
+std::pair<Worker<T>, Stealer<T>> deque(long release_count = 1) {
+  auto d = std::make_shared<SplitDeque<T>>(release_count);
+  return {Worker<T>(d), Stealer<T>(d)};
+}
+
+} // namespace split
+} // namespace deque
+
+#endif // SPLIT_DEQUE_HPP
@@ -0,0 +1,154 @@
+#ifndef THE_DEQUE_HPP
+#define THE_DEQUE_HPP
+
+#include <atomic>
+#include <experimental/optional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace deque {
+namespace the {
+
+// A deque using the THE protocol from "The Implementation of the
+// Cilk-5 Multithreaded Language", for comparison with the Chase-Lev
+// deque.
+//
+// Thieves always take the lock. The owner only takes it when a pop
+// might conflict with a steal, i.e. when the deque is down to its last
+// item, and when the buffer has to grow. Since thieves only touch the
+// buffer under the lock, the old buffer can be freed right away.
+template <typename T>
+class Deque {
+private:
+  // `head` is the thieves' end, `tail` the owner's.
+  std::atomic<long> head;
+  std::atomic<long> tail;
+  std::mutex lock;
+  std::vector<T> segment;
+  static const int log_initial_size = 4;
+
+  long size() const {
+    return static_cast<long>(segment.size());
+  }
+
+  // Called with the lock held.
+  void grow(long h, long t) {
+    std::vector<T> bigger(segment.size() * 2);
+    for (auto i = h; i < t; ++i)
+      bigger[i % bigger.size()] = segment[i % size()];
+    segment.swap(bigger);
+  }
+
+public:
+  Deque() : head(0), tail(0), lock(), segment(1 << log_initial_size) {
+  }
+
+  void push_bottom(const T object) {
+    auto t = tail.load(std::memory_order_relaxed);
+
+    // A thief bumps `head` before it reads the slot at the old head, so
+    // `head` can be one ahead of the slots still in use. Grow a slot
+    // early rather than overwrite the one being stolen.
+    if (t - head.load(std::memory_order_acquire) >= size() - 1) {
+      std::lock_guard<std::mutex> guard(lock);
+      grow(head.load(std::memory_order_relaxed), t);
+    }
+
+    segment[t % size()] = object;
+    tail.store(t + 1, std::memory_order_release);
+  }
+
+  std::experimental::optional<T> pop_bottom() {
+    auto t = tail.load(std::memory_order_relaxed) - 1;
+    tail.store(t, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::experimental::optional<T> popped = {};
+
+    if (head.load(std::memory_order_relaxed) > t) {
+      // Possible conflict: back off and retry under the lock.
+      tail.store(t + 1, std::memory_order_relaxed);
+      std::lock_guard<std::mutex> guard(lock);
+      tail.store(t, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      if (head.load(std::memory_order_relaxed) > t) {
+        tail.store(t + 1, std::memory_order_relaxed);
+        return popped;
+      }
+    }
+
+    popped = segment[t % size()];
+    return popped;
+  }
+
+  std::experimental::optional<T> steal() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::experimental::optional<T> stolen = {};
+
+    auto h = head.load(std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (h + 1 > tail.load(std::memory_order_relaxed)) {
+      head.store(h, std::memory_order_relaxed);
+      return stolen;
+    }
+
+    stolen = segment[h % size()];
+    return stolen;
+  }
+};
+
+template <typename T>
+class Worker {
+private:
+  std::shared_ptr<Deque<T>> deque;
+
+public:
+  explicit Worker(std::shared_ptr<Deque<T>> d) : deque(d) {
+  }
+
+  // There can only be one worker end.
+  Worker(const Worker<T> &w) = delete;
+
+  Worker(Worker<T> &&w) : deque(std::move(w.deque)) {
+  }
+
+  void push(const T item) {
+    deque->push_bottom(item);
+  }
+
+  std::experimental::optional<T> pop() {
+    return deque->pop_bottom();
+  }
+};
+
+// Thieves synchronize through the lock, so copies don't need to
+// register.
+template <typename T>
+class Stealer {
+private:
+  std::shared_ptr<Deque<T>> deque;
+
+public:
+  explicit Stealer(std::shared_ptr<Deque<T>> d) : deque(d) {
+  }
+
+  std::experimental::optional<T> steal() {
+    return deque->steal();
+  }
+};
+
+// Same as deque::deque().
+template <typename T>
+std::pair<Worker<T>, Stealer<T>> deque() {
+  auto d = std::make_shared<Deque<T>>();
+  return {Worker<T>(d), Stealer<T>(d)};
+}
+
+} // namespace the
+} // namespace deque
+
+#endif // THE_DEQUE_HPP
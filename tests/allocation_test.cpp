@@ -0,0 +1,115 @@
+#define CATCH_CONFIG_MAIN
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "deque.hpp"
+
+// Every allocation made by this binary goes through here.
+static std::atomic<long> allocations(0);
+
+// Once these are inlined GCC sees malloc paired with delete and warns
+// (-Wmismatched-new-delete), so keep them out of line.
+#if defined(__GNUC__) || defined(__clang__)
+#define ALLOCATION_TEST_NOINLINE __attribute__((noinline))
+#else
+#define ALLOCATION_TEST_NOINLINE
+#endif
+
+ALLOCATION_TEST_NOINLINE void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+ALLOCATION_TEST_NOINLINE void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+ALLOCATION_TEST_NOINLINE void operator delete(void *p,
+                                              std::size_t) noexcept {
+  std::free(p);
+}
+
+// Large enough to be stored out of line.
+struct big_work {
+  long label;
+  long payload[7];
+};
+
+// The item pushed `i`-th.
+template <typename T>
+T make_item(long i) {
+  return T(i);
+}
+
+template <>
+big_work make_item<big_work>(long i) {
+  return big_work{i, {i, i, i, i, i, i, i}};
+}
+
+// Push and pop `rounds` times, with the deque growing to `depth` items
+// and draining again, while `nthreads` thieves steal. Returns the
+// number of allocations made after the first round.
+template <typename T>
+long steady_state_allocations(int rounds, int depth, int nthreads) {
+  auto ws = deque::deque<T>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+  worker.reserve(depth);
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> threads;
+
+  for (auto i = 0; i < nthreads; ++i) {
+    // Copy (and register) the stealer before the threads start.
+    threads.emplace_back([&done](deque::Stealer<T> clone) {
+      while (!done.load(std::memory_order_relaxed))
+        clone.steal();
+    }, stealer);
+  }
+
+  long warm = 0;
+  for (auto r = 0; r < rounds; ++r) {
+    if (r == 1)
+      warm = allocations.load();
+
+    for (auto i = 0; i < depth; ++i)
+      worker.push(make_item<T>(i));
+    while (worker.pop())
+      ;
+  }
+  auto steady = allocations.load() - warm;
+
+  done.store(true);
+  for (auto &t : threads)
+    t.join();
+
+  return steady;
+}
+
+TEST_CASE("no allocations once warm", "[allocation]") {
+  REQUIRE(steady_state_allocations<long>(1000, 1000, 0) == 0);
+  REQUIRE(steady_state_allocations<long>(1000, 1000, 4) == 0);
+}
+
+TEST_CASE("no allocations once warm, out of line", "[allocation]") {
+  REQUIRE(steady_state_allocations<big_work>(1000, 1000, 0) == 0);
+  REQUIRE(steady_state_allocations<big_work>(1000, 1000, 4) == 0);
+}
+
+TEST_CASE("the counter sees allocations", "[allocation]") {
+  auto before = allocations.load();
+  auto ws = deque::deque<long>();
+  auto worker = std::move(ws.first);
+
+  // Outgrowing the buffer allocates.
+  for (auto i = 0; i < 1000; ++i)
+    worker.push(i);
+  REQUIRE(allocations.load() > before);
+}
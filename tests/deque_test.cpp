@@ -2,6 +2,11 @@
 
 #include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <sstream>
 #include <thread>
 #include <vector>
 
@@ -132,3 +137,768 @@ TEST_CASE("pop and steal", "[deque]") {
 
   REQUIRE(remaining == 0);
 }
+
+// Dummy task belonging to a cancellable group.
+struct group_task {
+  int label;
+  deque::CancellationToken *token;
+};
+
+TEST_CASE("discard and skip cancelled tasks", "[deque]") {
+  auto ws = deque::deque<group_task>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto is_cancelled = [](const group_task &t) {
+    return t.token->is_cancelled();
+  };
+
+  deque::CancellationToken outer, inner;
+
+  for (auto i = 0; i < 10; ++i)
+    worker.push(group_task{1, &outer});
+  for (auto i = 0; i < 100; ++i)
+    worker.push(group_task{2, &inner});
+
+  // Nothing is cancelled yet.
+  REQUIRE(worker.discard(is_cancelled) == 0);
+
+  // Only the inner group's run at the bottom is dropped.
+  inner.cancel();
+  REQUIRE(worker.discard(is_cancelled) == 100);
+  REQUIRE((*worker.pop()).label == 1);
+
+  // Thieves skip cancelled entries.
+  worker.push(group_task{2, &inner});
+  worker.push(group_task{1, &outer});
+  worker.push(group_task{1, &outer});
+  REQUIRE(worker.discard(is_cancelled) == 0);
+  for (auto i = 0; i < 11; ++i)
+    REQUIRE((*stealer.steal(is_cancelled)).label == 1);
+  REQUIRE(!stealer.steal(is_cancelled));
+
+  // Discarding everything leaves an empty, usable deque.
+  for (auto i = 0; i < 50; ++i)
+    worker.push(group_task{1, &outer});
+  outer.cancel();
+  REQUIRE(worker.discard(is_cancelled) == 50);
+  REQUIRE(!worker.pop());
+  REQUIRE(!stealer.steal());
+  worker.push(group_task{3, &inner});
+  REQUIRE((*worker.pop()).label == 3);
+}
+
+TEST_CASE("stealer views and intrusive handles", "[deque]") {
+  auto ws = deque::intrusive_deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        // Short-lived views share the clone's registration.
+        auto view = clone.view();
+        auto x = view.steal();
+        if (x) {
+          assert(*x == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max; ++i)
+    worker.push(1);
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+  REQUIRE(!stealer.view().steal());
+}
+
+TEST_CASE("steal from a set of deques", "[deque]") {
+  auto ndeques = 4;
+  auto wss = deque::deques<int>(ndeques);
+  auto workers = std::move(wss.first);
+  auto stealers = std::move(wss.second);
+  REQUIRE(stealers.size() == 4);
+
+  // Nothing to steal yet.
+  REQUIRE(!stealers.steal());
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealers, &remaining]() {
+      auto clone = stealers;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          assert(*x == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max; ++i)
+    workers[i % ndeques].push(1);
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+
+  workers[2].push(3);
+  REQUIRE(!stealers.steal_from(1));
+  REQUIRE(*stealers.steal_from(2) == 3);
+}
+
+TEST_CASE("snapshots", "[deque]") {
+  auto wss = deque::deques<int>(2);
+  auto workers = std::move(wss.first);
+  auto stealers = std::move(wss.second);
+
+  auto empty = workers[0].snapshot();
+  REQUIRE(empty.size() == 0);
+  REQUIRE(empty.capacity == 16);
+  REQUIRE(empty.pending_reclaim == 0);
+
+  for (auto i = 0; i < 100; ++i)
+    workers[0].push(i);
+  stealers.steal_from(0);
+
+  auto snaps = stealers.snapshot();
+  REQUIRE(snaps.size() == 2);
+  REQUIRE(snaps[0].top == 1);
+  REQUIRE(snaps[0].bottom == 100);
+  REQUIRE(snaps[0].size() == 99);
+  REQUIRE(snaps[0].capacity == 128);
+  // No stealer is active, so every unlinked buffer was reclaimed.
+  REQUIRE(snaps[0].pending_reclaim == 0);
+  REQUIRE(snaps[1].size() == 0);
+
+  std::ostringstream json;
+  deque::write_json(json, snaps);
+  REQUIRE(json.str() ==
+          "[{\"top\":1,\"bottom\":100,\"size\":99,\"capacity\":128,"
+          "\"pending_reclaim\":0},{\"top\":0,\"bottom\":0,\"size\":0,"
+          "\"capacity\":16,\"pending_reclaim\":0}]");
+}
+
+TEST_CASE("batch pops", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  std::vector<int> batch;
+  REQUIRE(worker.pop_batch(std::back_inserter(batch), 4) == 0);
+
+  for (auto i = 0; i < 10; ++i)
+    worker.push(i);
+
+  REQUIRE(worker.pop_batch(std::back_inserter(batch), 4) == 4);
+  REQUIRE(batch == std::vector<int>({9, 8, 7, 6}));
+
+  // A batch reaching `top` takes what is left.
+  REQUIRE(*stealer.steal() == 0);
+  batch.clear();
+  REQUIRE(worker.pop_batch(std::back_inserter(batch), 100) == 5);
+  REQUIRE(batch == std::vector<int>({5, 4, 3, 2, 1}));
+  REQUIRE(!worker.pop());
+  REQUIRE(!stealer.steal());
+
+  worker.push(1);
+  REQUIRE(*worker.pop() == 1);
+}
+
+// An output iterator calling `f` on every item written to it.
+struct calling_iterator {
+  std::function<void(int)> f;
+
+  calling_iterator &operator*() {
+    return *this;
+  }
+
+  calling_iterator &operator++() {
+    return *this;
+  }
+
+  calling_iterator operator++(int) {
+    return *this;
+  }
+
+  calling_iterator &operator=(int x) {
+    f(x);
+    return *this;
+  }
+};
+
+TEST_CASE("batch pop losing the race for top", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  worker.push(0);
+  worker.push(1);
+
+  // The batch reaches `top`. While it hands out item 1 we push item 2
+  // and let two steals through, so `top` moves past the item the batch
+  // was going to CAS for.
+  std::vector<int> popped, stolen;
+  auto out = calling_iterator{[&](int x) {
+    popped.push_back(x);
+    if (popped.size() == 1) {
+      worker.push(2);
+      stolen.push_back(*stealer.steal());
+      stolen.push_back(*stealer.steal());
+    }
+  }};
+  REQUIRE(worker.pop_batch(out, 2) == 1);
+  REQUIRE(popped == std::vector<int>({1}));
+  REQUIRE(stolen == std::vector<int>({0, 2}));
+
+  REQUIRE(!worker.pop());
+  REQUIRE(!stealer.steal());
+  REQUIRE(worker.snapshot().size() == 0);
+}
+
+TEST_CASE("batch pops against steals", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < max; ++i)
+    worker.push(1);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          assert(*x == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  int batch[7];
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto n = worker.pop_batch(batch, 7);
+    for (auto i = 0; i < n; ++i)
+      assert(batch[i] == 1);
+    remaining.fetch_sub(n);
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+}
+
+TEST_CASE("lazy publication", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  worker.set_publish_interval(4);
+
+  // Nothing is visible to thieves until four pushes.
+  for (auto i = 0; i < 3; ++i)
+    worker.push(i);
+  REQUIRE(worker.snapshot().bottom == 0);
+  // The owner counts them all the same.
+  REQUIRE(worker.depth() == 3);
+  worker.push(3);
+  REQUIRE(worker.snapshot().bottom == 4);
+
+  // Unpublished pushes are popped privately.
+  worker.push(4);
+  REQUIRE(*worker.pop() == 4);
+  REQUIRE(*worker.pop() == 3);
+  REQUIRE(*stealer.steal() == 0);
+
+  // A thief that comes up empty gets the next push published.
+  worker.push(5);
+  REQUIRE(*stealer.steal() == 1);
+  REQUIRE(*stealer.steal() == 2);
+  REQUIRE(!stealer.steal());
+  worker.push(6);
+  REQUIRE(*stealer.steal() == 5);
+  REQUIRE(*stealer.steal() == 6);
+
+  // Publishing by hand.
+  worker.push(7);
+  REQUIRE(!stealer.steal());
+  worker.publish();
+  REQUIRE(*stealer.steal() == 7);
+  REQUIRE(!worker.pop());
+  REQUIRE(worker.depth() == 0);
+
+  // Popping unpublished items publishes them for a thief that came
+  // up empty, too.
+  worker.set_publish_interval(16);
+  for (auto i = 8; i < 11; ++i)
+    worker.push(i);
+  REQUIRE(!stealer.steal());
+  REQUIRE(*worker.pop() == 10);
+  REQUIRE(*stealer.steal() == 8);
+  REQUIRE(*worker.pop() == 9);
+}
+
+TEST_CASE("lazy publication against steals", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  worker.set_publish_interval(16);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          assert(*x == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max; ++i) {
+    worker.push(1);
+    if (i % 3 == 0) {
+      auto x = worker.pop();
+      if (x) {
+        assert(*x == 1);
+        remaining.fetch_sub(1);
+      }
+    }
+  }
+  worker.publish();
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+}
+
+// Sum [lo, hi), splitting off the upper half only when a thief asks.
+static long sum_on_demand(deque::Worker<std::pair<long, long>> &worker,
+                          long lo, long hi, long &pushes) {
+  if (hi - lo <= 16) {
+    long sum = 0;
+    for (auto i = lo; i < hi; ++i)
+      sum += i;
+    return sum;
+  }
+
+  auto mid = lo + (hi - lo) / 2;
+  if (worker.thieves_waiting()) {
+    worker.push({mid, hi});
+    ++pushes;
+    return sum_on_demand(worker, lo, mid, pushes);
+  }
+
+  return sum_on_demand(worker, lo, mid, pushes) +
+         sum_on_demand(worker, mid, hi, pushes);
+}
+
+TEST_CASE("thieves waiting", "[deque]") {
+  auto ws = deque::deque<std::pair<long, long>>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  REQUIRE(!worker.thieves_waiting());
+
+  // Nobody asked, so nothing is pushed.
+  long pushes = 0;
+  REQUIRE(sum_on_demand(worker, 0, 1 << 16, pushes) == (1L << 31) - (1 << 15));
+  REQUIRE(pushes == 0);
+
+  // A failed steal asks for exactly one split.
+  REQUIRE(!stealer.steal());
+  REQUIRE(worker.thieves_waiting());
+  auto sum = sum_on_demand(worker, 0, 1 << 16, pushes);
+  REQUIRE(pushes == 1);
+  REQUIRE(!worker.thieves_waiting());
+
+  auto stolen = stealer.steal();
+  REQUIRE(stolen);
+  sum += sum_on_demand(worker, stolen->first, stolen->second, pushes);
+  REQUIRE(sum == (1L << 31) - (1 << 15));
+}
+
+TEST_CASE("growing in a reserved range", "[deque]") {
+  // Small enough to outgrow the range and fall back to normal buffers.
+  auto ws = deque::reserved_deque<int>(16);
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 200000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+  std::atomic<long> sum(0);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining, &sum]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          sum.fetch_add(*x);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max; ++i)
+    worker.push(i);
+
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto x = worker.pop();
+    if (x) {
+      sum.fetch_add(*x);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+  REQUIRE(sum == static_cast<long>(max) * (max - 1) / 2);
+}
+
+TEST_CASE("growing in place around thieves on older buffers", "[deque]") {
+  deque::Deque<long> d(20);
+
+  for (long i = 0; i < 16; ++i) {
+    d.push_bottom(i);
+    REQUIRE(*d.steal() == i);
+  }
+
+  // A thief still holding the 16-slot buffer.
+  auto old = d.buffer.load();
+  auto tls = d.reclaimer.register_thread();
+  tls->id_last_used.store(old->id());
+  tls->was_idle.store(false);
+
+  // Grows in place to 32 slots; items 16 to 30 move up.
+  for (long i = 16; i < 32; ++i)
+    d.push_bottom(i);
+  REQUIRE(d.snapshot().capacity == 32);
+  REQUIRE(d.buffer.load()->in_reserved_range());
+  REQUIRE(*d.steal() == 16);
+
+  // Slot 32 of the new buffer is slot 16 of the old one, where the
+  // thief could still be reading the item it took, so the push moves
+  // to an ordinary buffer instead of waiting for the thief.
+  d.push_bottom(32);
+  REQUIRE(old->get(16) == 16);
+  REQUIRE(!d.buffer.load()->in_reserved_range());
+  REQUIRE(d.snapshot().bottom == 33);
+
+  for (long i = 17; i < 33; ++i)
+    REQUIRE(*d.steal() == i);
+  REQUIRE(!d.steal());
+  tls->was_idle.store(true);
+}
+
+// Large enough to be stored out of line.
+struct big_work {
+  long label;
+  long payload[7];
+};
+
+TEST_CASE("out-of-line storage for large items", "[deque]") {
+  // Out-of-line slots are pointers, so even a reserved deque works.
+  auto ws = deque::reserved_deque<big_work>(20);
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  for (auto round = 0; round < 3; ++round) {
+    for (long i = 0; i < 1000; ++i)
+      worker.push(big_work{i, {i, i, i, i, i, i, i}});
+
+    REQUIRE((*stealer.steal()).label == 0);
+    REQUIRE(worker.discard([](const big_work &w) { return w.label >= 900; }) ==
+            100);
+
+    long sum = 0;
+    auto intact = true;
+    while (auto x = worker.pop()) {
+      intact = intact && x->payload[6] == x->label;
+      sum += x->label;
+    }
+    REQUIRE(intact);
+    REQUIRE(sum == 899L * 900 / 2);
+  }
+}
+
+TEST_CASE("out-of-line items are taken once and released", "[deque]") {
+  // Not trivially copyable, so stored out of line.
+  auto ws = deque::deque<std::shared_ptr<long>>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  // Taking an item moves it out of its node.
+  auto p = std::make_shared<long>(1);
+  worker.push(p);
+  worker.push(p);
+  REQUIRE(p.use_count() == 3);
+  stealer.steal();
+  worker.pop();
+  REQUIRE(p.use_count() == 1);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+  std::vector<std::atomic<int>> taken(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining, &taken]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          taken[**x].fetch_add(1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (long i = 0; i < max; ++i) {
+    worker.push(std::make_shared<long>(i));
+    if (i % 2 == 0)
+      continue;
+    auto x = worker.pop();
+    if (x) {
+      taken[**x].fetch_add(1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto x = worker.pop();
+    if (x) {
+      taken[**x].fetch_add(1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  auto wrong = 0;
+  for (auto &n : taken)
+    wrong += n != 1;
+  REQUIRE(wrong == 0);
+}
+
+// An over-aligned item, as used by SIMD kernels.
+struct alignas(32) simd_work {
+  float lanes[8];
+};
+
+// Short queues of these share no cache lines between slots.
+struct padded_work {
+  long label;
+};
+
+namespace deque {
+template <>
+struct pad_slots<padded_work> : std::true_type {};
+} // namespace deque
+
+static_assert(sizeof(deque::cell<padded_work, true>) == DEQUE_CACHE_LINE,
+              "padded slots take a cache line each");
+static_assert(alignof(deque::cell<padded_work, true>) == DEQUE_CACHE_LINE,
+              "padded slots start on a cache line");
+
+TEST_CASE("slot layout", "[deque]") {
+  // new[] wouldn't honour this alignment before C++17.
+  void *allocation;
+  auto array = deque::aligned_new<simd_work>(3, allocation);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(array) % 32 == 0);
+  deque::aligned_delete(array, 3, allocation);
+
+  auto ws = deque::deque<simd_work>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  for (auto i = 0; i < 100; ++i)
+    worker.push(simd_work{{static_cast<float>(i)}});
+  REQUIRE((*stealer.steal()).lanes[0] == 0);
+  REQUIRE((*worker.pop()).lanes[0] == 99);
+
+  auto pws = deque::deque<padded_work>();
+  auto padded_worker = std::move(pws.first);
+  auto padded_stealer = std::move(pws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&padded_stealer, &remaining]() {
+      auto clone = padded_stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          assert((*x).label == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  // Keep the deque short, so that owner and thieves stay close.
+  for (auto i = 0; i < max; ++i) {
+    padded_worker.push(padded_work{1});
+    if (i % 2) {
+      auto x = padded_worker.pop();
+      if (x)
+        remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+}
+
+TEST_CASE("quiescent-state-based reclamation", "[deque]") {
+  auto nthreads = 4;
+  deque::Qsbr domain(nthreads);
+  deque::Deque<int> d(domain);
+
+  // Nobody has been quiescent yet, so retired buffers are kept.
+  for (auto i = 0; i < 100; ++i)
+    d.push_bottom(i);
+  REQUIRE(d.snapshot().pending_reclaim > 0);
+
+  for (auto i = 0; i < nthreads; ++i)
+    domain.quiescent(i);
+  d.push_bottom(100);
+  REQUIRE(d.snapshot().pending_reclaim == 0);
+
+  // Thieves of the domain steal without a Stealer.
+  auto max = 100000;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max + 101);
+  std::atomic<long> sum(0);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([i, &d, &domain, &remaining, &sum]() {
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = d.steal();
+        if (x) {
+          sum.fetch_add(*x);
+          remaining.fetch_sub(1);
+        }
+        domain.quiescent(i);
+      }
+      domain.offline(i);
+    });
+  }
+
+  for (auto i = 101; i < max + 101; ++i)
+    d.push_bottom(i);
+
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto x = d.pop_bottom();
+    if (x) {
+      sum.fetch_add(*x);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(sum == static_cast<long>(max + 101) * (max + 100) / 2);
+
+  // Offline threads don't hold up reclamation.
+  d.push_bottom(0);
+  REQUIRE(d.snapshot().pending_reclaim == 0);
+}
+
+TEST_CASE("termination detection", "[deque]") {
+  auto ws = deque::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  // The owner is thread `nthreads`.
+  deque::TerminationDetector detector(nthreads + 1);
+  REQUIRE(detector.terminated());
+
+  std::vector<std::thread> threads;
+  std::atomic<long> sum(0);
+
+  // Count everything up front, so thieves can't see an empty deque as
+  // the end before the owner has pushed.
+  detector.spawned(nthreads, max);
+  REQUIRE(!detector.terminated());
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([i, &stealer, &detector, &sum]() {
+      auto clone = stealer;
+      while (!detector.terminated()) {
+        auto x = clone.steal();
+        if (x) {
+          sum.fetch_add(*x);
+          detector.finished(i);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max; ++i)
+    worker.push(i);
+
+  while (!detector.terminated()) {
+    auto x = worker.pop();
+    if (x) {
+      sum.fetch_add(*x);
+      detector.finished(nthreads);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(!worker.pop());
+  REQUIRE(sum == static_cast<long>(max) * (max - 1) / 2);
+}
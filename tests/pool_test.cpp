@@ -0,0 +1,453 @@
+#define CATCH_CONFIG_MAIN
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "pool.hpp"
+
+TEST_CASE("tasks submitted from outside", "[pool]") {
+  deque::Pool pool(4);
+  REQUIRE(pool.size() == 4);
+  REQUIRE(pool.worker_index() == -1);
+
+  auto max = 10000;
+  std::atomic<long> sum(0);
+  std::atomic<bool> outside(false);
+
+  for (auto i = 0; i < max; ++i) {
+    pool.submit([i, &pool, &sum, &outside]() {
+      auto w = pool.worker_index();
+      if (w < 0 || w >= static_cast<long>(pool.size()))
+        outside.store(true);
+      sum.fetch_add(i);
+    });
+  }
+
+  pool.wait();
+  REQUIRE(!outside.load());
+  REQUIRE(sum == static_cast<long>(max) * (max - 1) / 2);
+}
+
+// Submit a binary tree of tasks with 2^depth leaves.
+void tree(deque::Pool &pool, int depth, std::atomic<long> &leaves) {
+  if (depth == 0) {
+    leaves.fetch_add(1);
+    return;
+  }
+
+  for (auto i = 0; i < 2; ++i)
+    pool.submit([&pool, depth, &leaves]() { tree(pool, depth - 1, leaves); });
+}
+
+TEST_CASE("tasks submitted by tasks", "[pool]") {
+  deque::Pool pool(4);
+  std::atomic<long> leaves(0);
+
+  pool.submit([&pool, &leaves]() { tree(pool, 14, leaves); });
+  pool.wait();
+  REQUIRE(leaves == 1 << 14);
+
+  // The pool can be reused after a wait.
+  pool.submit([&pool, &leaves]() { tree(pool, 10, leaves); });
+  pool.wait();
+  REQUIRE(leaves == (1 << 14) + (1 << 10));
+}
+
+TEST_CASE("destroying a pool waits for its tasks", "[pool]") {
+  std::atomic<long> leaves(0);
+  {
+    deque::Pool pool(2);
+    pool.submit([&pool, &leaves]() { tree(pool, 12, leaves); });
+  }
+  REQUIRE(leaves == 1 << 12);
+}
+
+TEST_CASE("idle workers sleep", "[pool]") {
+  deque::Pool pool(4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  // std::clock() is the CPU time of the whole process. Parked workers
+  // shouldn't use any while the main thread sleeps.
+  auto cpu = std::clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  auto seconds = static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC;
+  REQUIRE(seconds < 0.05);
+
+  // And they wake up for new work.
+  std::atomic<long> leaves(0);
+  pool.submit([&pool, &leaves]() { tree(pool, 10, leaves); });
+  pool.wait();
+  REQUIRE(leaves == 1 << 10);
+}
+
+TEST_CASE("dissemination barrier", "[pool]") {
+  for (auto nthreads : {1, 2, 5, 8}) {
+    deque::DisseminationBarrier barrier(nthreads);
+    auto phases = 200;
+    std::vector<std::atomic<int>> reached(nthreads);
+    std::atomic<bool> early(false);
+    std::vector<std::thread> threads;
+
+    for (auto &r : reached)
+      r.store(0);
+
+    for (auto i = 0; i < nthreads; ++i) {
+      threads.emplace_back([=, &barrier, &reached, &early]() {
+        for (auto p = 1; p <= phases; ++p) {
+          reached[i].store(p);
+          barrier.arrive_and_wait(i);
+          for (auto &r : reached) {
+            if (r.load() < p)
+              early.store(true);
+          }
+        }
+      });
+    }
+
+    for (auto &t : threads)
+      t.join();
+
+    REQUIRE(!early.load());
+  }
+}
+
+TEST_CASE("phases on every worker", "[pool]") {
+  deque::Pool pool(4);
+  auto phases = 100;
+  std::vector<std::atomic<int>> reached(pool.size());
+  std::atomic<bool> early(false);
+  std::atomic<long> leaves(0);
+
+  for (auto &r : reached)
+    r.store(0);
+
+  pool.run_on_each([&](std::size_t i) {
+    // Tasks submitted during a phase run on whoever is waiting.
+    if (i == 0)
+      tree(pool, 10, leaves);
+
+    for (auto p = 1; p <= phases; ++p) {
+      reached[i].store(p);
+      pool.barrier();
+      for (auto &r : reached) {
+        if (r.load() < p)
+          early.store(true);
+      }
+      // Nobody may get to the next phase before we've checked.
+      pool.barrier();
+    }
+  });
+
+  REQUIRE(!early.load());
+  REQUIRE(leaves == 1 << 10);
+}
+
+TEST_CASE("worker-local storage", "[pool]") {
+  deque::Pool pool(4);
+  auto buckets = 16;
+  auto max = 100000;
+
+  std::atomic<int> created(0);
+  deque::Combinable<std::vector<long>> histogram(pool, [&]() {
+    created.fetch_add(1);
+    return std::vector<long>(buckets);
+  });
+
+  for (auto i = 0; i < max; ++i)
+    pool.submit([=, &histogram]() { ++histogram.local()[i % buckets]; });
+  pool.wait();
+
+  // Only the workers that ran something made a histogram.
+  REQUIRE(created.load() >= 1);
+  REQUIRE(created.load() <= static_cast<int>(pool.size()));
+
+  auto total = histogram.combine(
+    [](std::vector<long> a, const std::vector<long> &b) {
+      for (std::size_t j = 0; j < a.size(); ++j)
+        a[j] += b[j];
+      return a;
+    });
+  for (auto count : total)
+    REQUIRE(count == max / buckets);
+
+  // From outside the pool.
+  deque::Combinable<long> sum(pool);
+  REQUIRE(sum.combine(std::plus<long>()) == 0);
+  sum.local() = 5;
+  pool.submit([&sum]() { sum.local() += 2; });
+  pool.wait();
+  REQUIRE(sum.combine(std::plus<long>()) == 7);
+
+  sum.clear();
+  REQUIRE(sum.combine(std::plus<long>()) == 0);
+}
+
+struct concat {
+  std::vector<int> operator()(std::vector<int> a, std::vector<int> b) const {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+  }
+};
+
+// Append lo, ..., hi - 1 to the reducer, splitting the range with
+// joins.
+void append_range(deque::Pool &pool,
+                  deque::Reducer<std::vector<int>, concat> &out, int lo,
+                  int hi) {
+  if (hi - lo <= 4) {
+    for (auto i = lo; i < hi; ++i)
+      out.view().push_back(i);
+    return;
+  }
+
+  auto mid = lo + (hi - lo) / 2;
+  pool.join([&pool, &out, lo, mid]() { append_range(pool, out, lo, mid); },
+            [&pool, &out, mid, hi]() { append_range(pool, out, mid, hi); });
+}
+
+TEST_CASE("joins and reducers", "[pool]") {
+  deque::Pool pool(4);
+  auto max = 100000;
+
+  deque::Reducer<std::vector<int>, concat> out;
+  deque::Reducer<long> sum;
+
+  pool.submit([&]() {
+    out.view().push_back(-1);
+    append_range(pool, out, 0, max);
+    out.view().push_back(max);
+
+    pool.join([&]() { sum.view() += 1; }, [&]() { sum.view() += 2; });
+  });
+  pool.wait();
+
+  // Same order as a serial run.
+  auto &v = out.get();
+  REQUIRE(v.size() == static_cast<std::size_t>(max + 2));
+  auto in_order = true;
+  for (auto i = 0; i < max + 2; ++i)
+    in_order = in_order && v[i] == i - 1;
+  REQUIRE(in_order);
+  REQUIRE(sum.get() == 3);
+
+  // Outside the pool join() runs serially.
+  std::vector<int> order;
+  pool.join([&]() { order.push_back(0); }, [&]() { order.push_back(1); });
+  REQUIRE(order == std::vector<int>({0, 1}));
+}
+
+TEST_CASE("reducers declared in a stolen strand", "[pool]") {
+  deque::Pool pool(4);
+  std::atomic<bool> outer_stolen(false);
+  std::vector<int> result;
+
+  // Each first half waits for its second half to start, so both
+  // second halves are stolen.
+  pool.submit([&]() {
+    pool.join(
+      [&]() {
+        while (!outer_stolen.load())
+          std::this_thread::yield();
+      },
+      [&]() {
+        outer_stolen.store(true);
+        deque::Reducer<std::vector<int>, concat> r;
+        std::atomic<bool> inner_stolen(false);
+        pool.join(
+          [&]() {
+            r.view().push_back(1);
+            while (!inner_stolen.load())
+              std::this_thread::yield();
+          },
+          [&]() {
+            inner_stolen.store(true);
+            r.view().push_back(2);
+          });
+        result = r.get();
+      });
+  });
+  pool.wait();
+
+  REQUIRE(result == std::vector<int>({1, 2}));
+}
+
+TEST_CASE("seeding every worker", "[pool]") {
+  deque::Pool pool(4);
+  auto max = 10000;
+  std::vector<std::atomic<int>> runs(max);
+  for (auto &r : runs)
+    r.store(0);
+
+  for (auto round = 0; round < 3; ++round) {
+    std::vector<deque::Pool::task> tasks;
+    for (auto i = 0; i < max; ++i)
+      tasks.emplace_back([i, &runs]() { runs[i].fetch_add(1); });
+
+    pool.seed(std::move(tasks));
+    pool.wait();
+  }
+
+  auto all_three = true;
+  for (auto &r : runs)
+    all_three = all_three && r.load() == 3;
+  REQUIRE(all_three);
+
+  // Fewer tasks than workers.
+  std::atomic<int> few(0);
+  pool.seed({[&few]() { few.fetch_add(1); }});
+  pool.wait();
+  REQUIRE(few == 1);
+}
+
+TEST_CASE("parallel loops", "[pool]") {
+  deque::Pool pool(4);
+  auto max = 100000;
+  std::vector<std::atomic<int>> visits(max);
+  for (auto &v : visits)
+    v.store(0);
+
+  auto body = [&visits](long lo, long hi) {
+    for (auto i = lo; i < hi; ++i)
+      visits[i].fetch_add(1);
+  };
+
+  pool.parallel_for(0, max, 1000, body);
+
+  // Replayed with affinity. `ap` records where each chunk ran, and the
+  // next pass mostly runs it there again.
+  deque::AffinityPartitioner ap;
+  std::vector<long> ran_on(100);
+  std::vector<std::size_t> recorded(100);
+  auto tracked = [&](long lo, long hi) {
+    ran_on[lo / 1000] = pool.worker_index();
+    body(lo, hi);
+  };
+
+  auto passes = 5;
+  for (auto pass = 0; pass < passes; ++pass) {
+    pool.parallel_for(0, max, 1000, tracked, ap);
+
+    auto replayed = 0;
+    auto matches = true;
+    for (long c = 0; c < 100; ++c) {
+      if (pass > 0)
+        replayed += ran_on[c] == static_cast<long>(recorded[c]);
+      matches = matches && static_cast<long>(ap.worker_of(c)) == ran_on[c];
+      recorded[c] = ap.worker_of(c);
+    }
+    REQUIRE(matches);
+    if (pass > 0)
+      REQUIRE(replayed >= 50);
+  }
+
+  auto once_per_pass = true;
+  for (auto &v : visits)
+    once_per_pass = once_per_pass && v.load() == passes + 1;
+  REQUIRE(once_per_pass);
+
+  // Inside the pool, and an empty range.
+  std::atomic<long> sum(0);
+  pool.submit([&]() {
+    pool.parallel_for(0, 1000, 7, [&sum](long lo, long hi) {
+      for (auto i = lo; i < hi; ++i)
+        sum.fetch_add(i);
+    });
+    pool.parallel_for(5, 5, 1, [&sum](long, long) { sum.fetch_add(1); });
+  });
+  pool.wait();
+  REQUIRE(sum == 999 * 1000 / 2);
+}
+
+TEST_CASE("tasks with affinity", "[pool]") {
+  deque::Pool pool(4);
+  auto tiles = 1000;
+  std::vector<std::atomic<int>> runs(tiles);
+  for (auto &r : runs)
+    r.store(0);
+
+  // Each producer hands its tiles to the next worker.
+  pool.run_on_each([&](std::size_t i) {
+    auto next = (i + 1) % pool.size();
+    for (auto k = static_cast<int>(i); k < tiles;
+         k += static_cast<int>(pool.size()))
+      pool.submit_with_affinity(next, [k, &runs]() { runs[k].fetch_add(1); });
+  });
+
+  // And from outside the pool.
+  pool.submit_with_affinity(2, [&runs]() { runs[0].fetch_add(1); });
+  pool.wait();
+
+  auto once = true;
+  for (auto k = 1; k < tiles; ++k)
+    once = once && runs[k].load() == 1;
+  REQUIRE(once);
+  REQUIRE(runs[0].load() == 2);
+}
+
+TEST_CASE("weighted job groups", "[pool]") {
+  // One worker, so the order tasks run in is the schedule.
+  deque::Pool pool(1, {3, 1});
+  REQUIRE(pool.group_count() == 2);
+
+  std::atomic<bool> go(false);
+  pool.submit_to_group(0, [&go]() {
+    while (!go.load())
+      std::this_thread::yield();
+  });
+
+  // Both groups queue up plenty of work, group 1 first.
+  auto per_group = 1000;
+  std::vector<int> order;
+  for (auto g : {1, 0}) {
+    for (auto k = 0; k < per_group; ++k)
+      pool.submit_to_group(g, [g, &order]() { order.push_back(g); });
+  }
+  go.store(true);
+  pool.wait();
+
+  REQUIRE(order.size() == static_cast<std::size_t>(2 * per_group));
+
+  // Group 0 gets three turns for every one of group 1's while both
+  // have work.
+  auto first = std::count(order.begin(), order.begin() + 400, 0);
+  REQUIRE(first >= 290);
+  REQUIRE(first <= 310);
+}
+
+TEST_CASE("depth-bounded spawning", "[pool]") {
+  deque::Pool pool(4);
+  pool.set_spawn_limit(8);
+
+  // One task spawning far faster than the others can steal.
+  auto max = 20000;
+  std::atomic<long> sum(0);
+  pool.submit([&]() {
+    for (auto i = 0; i < max; ++i)
+      pool.submit([i, &sum]() { sum.fetch_add(i); });
+  });
+  pool.wait();
+  REQUIRE(sum == static_cast<long>(max) * (max - 1) / 2);
+
+  std::atomic<long> leaves(0);
+  pool.submit([&pool, &leaves]() { tree(pool, 14, leaves); });
+  pool.wait();
+  REQUIRE(leaves == 1 << 14);
+
+  deque::Reducer<std::vector<int>, concat> out;
+  pool.submit([&]() { append_range(pool, out, 0, 10000); });
+  pool.wait();
+  REQUIRE(out.get().size() == 10000);
+  REQUIRE(std::is_sorted(out.get().begin(), out.get().end()));
+
+  // No deque ever grew past its initial buffer.
+  auto grew = false;
+  for (const auto &s : pool.snapshot())
+    grew = grew || s.capacity > 16;
+  REQUIRE(!grew);
+}
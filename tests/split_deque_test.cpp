@@ -0,0 +1,115 @@
+#define CATCH_CONFIG_MAIN
+
+#include <atomic>
+#include <cassert>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "split_deque.hpp"
+
+TEST_CASE("basic operations", "[split]") {
+  auto ws = deque::split::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  // Empty deque.
+  REQUIRE(!worker.pop());
+
+  // Single push, pop.
+  worker.push(100);
+  REQUIRE(*worker.pop() == 100);
+
+  // Steal when empty.
+  REQUIRE(!stealer.steal());
+
+  // Single push, steal.
+  worker.push(100);
+  REQUIRE(*stealer.steal() == 100);
+  REQUIRE(!worker.pop());
+}
+
+TEST_CASE("pop and steal", "[split]") {
+  auto ws = deque::split::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+
+  for (auto i = 0; i < max / 2; ++i)
+    worker.push(1);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          // Can't use REQUIRE here because it isn't thread-safe.
+          assert(*x == 1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  for (auto i = 0; i < max / 2; ++i) {
+    worker.push(1);
+    auto x = worker.pop();
+    if (x) {
+      assert(*x == 1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto x = worker.pop();
+    if (x) {
+      assert(*x == 1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+}
+
+
+TEST_CASE("release and reacquire", "[split]") {
+  auto ws = deque::split::deque<int>(2);
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  // The public part is empty, so the first push is released.
+  worker.push(0);
+  for (auto i = 1; i < 6; ++i)
+    worker.push(i);
+  REQUIRE(*stealer.steal() == 0);
+  REQUIRE(!stealer.steal());
+
+  // The next push releases the two oldest private items.
+  worker.push(6);
+  REQUIRE(*stealer.steal() == 1);
+
+  // Pops drain the private part, then reacquire from the public part.
+  REQUIRE(*worker.pop() == 6);
+  REQUIRE(*worker.pop() == 5);
+  REQUIRE(*worker.pop() == 4);
+  REQUIRE(*worker.pop() == 3);
+  REQUIRE(*worker.pop() == 2);
+  REQUIRE(!worker.pop());
+  REQUIRE(!stealer.steal());
+
+  // Releasing by hand.
+  worker.push(7);
+  worker.push(8);
+  worker.release();
+  REQUIRE(*stealer.steal() == 7);
+  REQUIRE(*stealer.steal() == 8);
+  REQUIRE(!stealer.steal());
+}
@@ -0,0 +1,85 @@
+#define CATCH_CONFIG_MAIN
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "the_deque.hpp"
+
+TEST_CASE("basic operations", "[the]") {
+  auto ws = deque::the::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  // Empty deque.
+  REQUIRE(!worker.pop());
+
+  // Single push, pop.
+  worker.push(100);
+  REQUIRE(*worker.pop() == 100);
+
+  // Steal when empty.
+  REQUIRE(!stealer.steal());
+
+  // Single push, steal.
+  worker.push(100);
+  REQUIRE(*stealer.steal() == 100);
+  REQUIRE(!worker.pop());
+}
+
+TEST_CASE("pop and steal", "[the]") {
+  auto ws = deque::the::deque<int>();
+  auto worker = std::move(ws.first);
+  auto stealer = std::move(ws.second);
+
+  auto max = 100000;
+  auto nthreads = 4;
+  std::vector<std::thread> threads;
+  std::atomic<int> remaining(max);
+  // How many times each item was taken; all should end up at 1.
+  std::vector<std::atomic<int>> taken(max);
+
+  for (auto i = 0; i < nthreads; ++i) {
+    threads.emplace_back([&stealer, &remaining, &taken]() {
+      auto clone = stealer;
+      while (remaining.load(std::memory_order_seq_cst) > 0) {
+        auto x = clone.steal();
+        if (x) {
+          taken[*x].fetch_add(1);
+          remaining.fetch_sub(1);
+        }
+      }
+    });
+  }
+
+  // Thieves are already running while the deque fills and grows.
+  for (auto i = 0; i < max / 2; ++i)
+    worker.push(i);
+
+  for (auto i = max / 2; i < max; ++i) {
+    worker.push(i);
+    auto x = worker.pop();
+    if (x) {
+      taken[*x].fetch_add(1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  while (remaining.load(std::memory_order_seq_cst) > 0) {
+    auto x = worker.pop();
+    if (x) {
+      taken[*x].fetch_add(1);
+      remaining.fetch_sub(1);
+    }
+  }
+
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(remaining == 0);
+  auto wrong = 0;
+  for (auto &n : taken)
+    wrong += n != 1;
+  REQUIRE(wrong == 0);
+}